@@ -12,7 +12,7 @@ function(fixup_cli_bundle exe_path)
   # we can pass the exe path directly.
   fixup_bundle("${exe_path}" "" "${CMAKE_INSTALL_PREFIX}")
 
-  # At this point, Exiv2 + its deps (zlib, expat, etc.) should be copied
+  # At this point, Exiv2, libqpdf + their deps (zlib, expat, etc.) should be copied
   # right next to 'cleanmeta' and their install names adjusted to @rpath/@loader_path.
   # If you prefer placing dylibs under ./lib, you can move them and run install_name_tool,
   # but keeping them beside the exe is simplest and robust.
@@ -0,0 +1,53 @@
+# Cleans a few HEIF image sequences (msf1, with a `moov` after `meta`)
+# and fails if the `stco` chunk offset in a cleaned copy no longer
+# points at the sample chunk, i.e. if bytes after `meta` were moved.
+#
+#   cmake -DCLEANMETA=<exe> -DBENCH=<exe> -DWORK=<dir> -P CheckHeifSequence.cmake
+
+file(REMOVE_RECURSE "${WORK}")
+
+# Sequences from the benchmark's generator
+execute_process(
+  COMMAND "${BENCH}" --files 3 --sizes 16K --densities 4 --threads 1 --formats heics
+          --dir "${WORK}/gen" --json "${WORK}/gen.json"
+  RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "cleanmeta-bench could not generate the corpus (${rc})")
+endif()
+file(GLOB corpus "${WORK}/gen/corpus/*/*.heic")
+
+execute_process(
+  COMMAND "${CLEANMETA}" -o "${WORK}/out" ${corpus}
+  RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE err)
+if(NOT rc EQUAL 0 OR NOT out MATCHES "Cleaned 3 / 3 files")
+  message(FATAL_ERROR "clean failed (${rc}):\n${out}${err}")
+endif()
+
+# The chunk marker the generator writes, as hex
+string(HEX "cleanmeta-sequence-chunk" marker)
+file(GLOB cleaned "${WORK}/out/*.heic")
+list(LENGTH cleaned n)
+if(NOT n EQUAL 3)
+  message(FATAL_ERROR "expected 3 cleaned files, found ${n}")
+endif()
+foreach(f ${cleaned})
+  file(READ "${f}" hex HEX)
+  # stco: type, version/flags, entry_count, then the 32-bit offset
+  string(FIND "${hex}" "7374636f" at)
+  if(at EQUAL -1)
+    message(FATAL_ERROR "${f}: no stco box")
+  endif()
+  math(EXPR at "${at} + 24")
+  string(SUBSTRING "${hex}" ${at} 8 off)
+  math(EXPR off "0x${off} * 2")
+  string(LENGTH "${marker}" len)
+  string(SUBSTRING "${hex}" ${off} ${len} chunk)
+  if(NOT chunk STREQUAL marker)
+    message(FATAL_ERROR "${f}: stco no longer points at the sample chunk")
+  endif()
+  string(FIND "${hex}" "457869660000" exif)  # "Exif\0\0"
+  if(NOT exif EQUAL -1)
+    message(FATAL_ERROR "${f}: Exif payload left in the cleaned copy")
+  endif()
+endforeach()
+file(REMOVE_RECURSE "${WORK}")
@@ -0,0 +1,43 @@
+# Runs `cleanmeta -r --in-place --dedup` twice over a tree that holds
+# its own dedup cache and fails if the second run cleaned anything
+# cleanmeta wrote itself: a .bak backup (which would leave a .bak.bak)
+# or a cached object.
+#
+#   cmake -DCLEANMETA=<exe> -DBENCH=<exe> -DWORK=<dir> -P CheckInPlaceBackups.cmake
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}/tree/sub")
+
+# A few JPEGs with metadata from the benchmark's generator
+execute_process(
+  COMMAND "${BENCH}" --files 3 --sizes 16K --densities 4 --threads 1 --formats jpeg
+          --dir "${WORK}/gen" --json "${WORK}/gen.json"
+  RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "cleanmeta-bench could not generate the corpus (${rc})")
+endif()
+file(GLOB corpus "${WORK}/gen/corpus/*/*.jpg")
+file(COPY ${corpus} DESTINATION "${WORK}/tree/sub")
+
+foreach(run 1 2)
+  execute_process(
+    COMMAND "${CLEANMETA}" -r --in-place --dedup "${WORK}/tree/cache" "${WORK}/tree"
+    RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE err)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "run ${run} failed (${rc}):\n${out}${err}")
+  endif()
+  if(out MATCHES "\\.bak" OR NOT out MATCHES "Cleaned 3 / 3 files")
+    message(FATAL_ERROR "run ${run} cleaned files cleanmeta wrote itself:\n${out}")
+  endif()
+endforeach()
+
+file(GLOB_RECURSE twice "${WORK}/tree/*.bak.bak")
+if(twice)
+  message(FATAL_ERROR "backups of backups: ${twice}")
+endif()
+file(GLOB backups "${WORK}/tree/sub/*.jpg.bak")
+list(LENGTH backups n)
+if(NOT n EQUAL 3)
+  message(FATAL_ERROR "expected 3 backups, found ${n}")
+endif()
+file(REMOVE_RECURSE "${WORK}")
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -------------------------------------------------------------
+// Work-stealing pool for batch cleaning
+//
+// Every worker owns a deque. Tasks submitted from inside a worker
+// (e.g. a directory task queueing the files it found) go to that
+// worker's own deque and are popped LIFO; idle workers steal FIFO
+// from the others. Tasks submitted from outside are spread
+// round-robin. wait() returns once every task, including the ones
+// spawned by other tasks, has finished.
+// -------------------------------------------------------------
+class BatchPool {
+public:
+    using Task = std::function<void(size_t worker)>;
+
+    explicit BatchPool(size_t threads) {
+        if (threads == 0) threads = 1;
+        for (size_t i = 0; i < threads; i++) workers_.push_back(std::make_unique<Worker>());
+        for (size_t i = 0; i < threads; i++) threads_.emplace_back([this, i] { run(i); });
+    }
+
+    ~BatchPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            stop_ = true;
+        }
+        idle_cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    BatchPool(const BatchPool&) = delete;
+    BatchPool& operator=(const BatchPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    void submit(Task task) {
+        size_t target = (current_pool() == this)
+            ? current_index()
+            : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+            workers_[target]->tasks.push_back(std::move(task));
+            queued_.fetch_add(1, std::memory_order_release);
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+        }
+        idle_cv_.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        done_cv_.wait(lock, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static BatchPool*& current_pool() {
+        static thread_local BatchPool* pool = nullptr;
+        return pool;
+    }
+    static size_t& current_index() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    bool pop_local(size_t i, Task& out) {
+        std::lock_guard<std::mutex> lock(workers_[i]->mutex);
+        if (workers_[i]->tasks.empty()) return false;
+        out = std::move(workers_[i]->tasks.back());
+        workers_[i]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Task& out) {
+        for (size_t k = 1; k < workers_.size(); k++) {
+            size_t victim = (thief + k) % workers_.size();
+            std::lock_guard<std::mutex> lock(workers_[victim]->mutex);
+            if (workers_[victim]->tasks.empty()) continue;
+            out = std::move(workers_[victim]->tasks.front());
+            workers_[victim]->tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t i) {
+        current_pool() = this;
+        current_index() = i;
+        Task task;
+        for (;;) {
+            if (pop_local(i, task) || steal(i, task)) {
+                queued_.fetch_sub(1, std::memory_order_relaxed);
+                task(i);
+                task = nullptr;
+                if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(idle_mutex_);
+                    done_cv_.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idle_mutex_);
+            idle_cv_.wait(lock, [this] {
+                return stop_ || queued_.load(std::memory_order_acquire) > 0;
+            });
+            if (stop_ && queued_.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::condition_variable done_cv_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> next_{0};
+    bool stop_ = false;
+};
@@ -0,0 +1,755 @@
+// cleanmeta-bench — throughput benchmark for the cleaning core
+//
+// Generates a reproducible synthetic corpus (JPEG, PNG, HEIC, PDF) at
+// the requested sizes and metadata densities under a temp directory,
+// cleans it with cleanmeta_core's clean_file per format, PDF mode, I/O
+// engine and thread count, and prints files/s, MB/s and p50/p99 per-file
+// latency as JSON.
+// Each case is also expressed relative to a plain read-and-write copy of
+// the same files at the same thread count, timed in the same run, so the
+// number carries over between machines. With --baseline it exits 3
+// when that ratio regresses past --threshold; any file that fails to
+// clean makes it exit 4, baseline or not.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_pool.h"
+#include "cleanmeta.h"
+#include "cli_args.h"
+
+// -------------------------------------------------------------
+// Deterministic generator helpers
+// -------------------------------------------------------------
+struct Rng {
+    uint64_t s;
+    uint64_t next() {  // splitmix64
+        uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    void fill(std::string& out, size_t n) {
+        for (size_t i = 0; i < n; i++) out += static_cast<char>(next() & 0xFF);
+    }
+};
+
+static void put_be16(std::string& s, uint32_t v) { s += char(v >> 8); s += char(v); }
+static void put_be32(std::string& s, uint32_t v) { put_be16(s, v >> 16); put_be16(s, v & 0xFFFF); }
+static void put_le16(std::string& s, uint32_t v) { s += char(v); s += char(v >> 8); }
+static void put_le32(std::string& s, uint32_t v) { put_le16(s, v & 0xFFFF); put_le16(s, v >> 16); }
+
+static uint32_t crc32(const std::string& data, size_t from = 0) {
+    static uint32_t table[256];
+    static bool init = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = from; i < data.size(); i++) c = table[(c ^ uint8_t(data[i])) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// Little-endian TIFF with `density` ASCII tags plus Orientation in IFD0
+static std::string make_tiff(size_t density) {
+    struct Entry { uint16_t tag; uint16_t type; std::string data; };
+    static const uint16_t named[] = {0x010E, 0x010F, 0x0110, 0x0131, 0x0132, 0x013B, 0x8298};
+    std::vector<Entry> entries;
+    entries.push_back({0x0112, 3, std::string("\x01\x00", 2)});  // Orientation = 1
+    for (size_t i = 0; i < density; i++) {
+        uint16_t tag = i < 7 ? named[i] : static_cast<uint16_t>(0xC400 + i);
+        entries.push_back({tag, 2, "cleanmeta bench value " + std::to_string(i) + std::string(1, '\0')});
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.tag < b.tag; });
+
+    std::string t = "II*";
+    t += '\0';
+    put_le32(t, 8);
+    uint32_t data_at = 8 + 2 + 12 * static_cast<uint32_t>(entries.size()) + 4;
+    std::string data;
+    put_le16(t, static_cast<uint32_t>(entries.size()));
+    for (auto& e : entries) {
+        put_le16(t, e.tag);
+        put_le16(t, e.type);
+        put_le32(t, static_cast<uint32_t>(e.type == 3 ? 1 : e.data.size()));
+        if (e.data.size() <= 4) {
+            std::string v = e.data;
+            v.resize(4, '\0');
+            t += v;
+        } else {
+            put_le32(t, data_at + static_cast<uint32_t>(data.size()));
+            data += e.data;
+            if (data.size() & 1) data += '\0';
+        }
+    }
+    put_le32(t, 0);
+    return t + data;
+}
+
+static std::string make_xmp(size_t density) {
+    std::string x = "<?xpacket begin=\"\xEF\xBB\xBF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"><rdf:RDF "
+        "xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+        "<rdf:Description rdf:about=\"\" xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\" "
+        "xmlns:bench=\"http://example.com/cleanmeta-bench/1.0/\">"
+        "<xmp:CreatorTool>cleanmeta-bench</xmp:CreatorTool>";
+    for (size_t i = 0; i < density; i++) {
+        x += "<bench:f" + std::to_string(i) + ">value " + std::to_string(i) + "</bench:f" +
+             std::to_string(i) + ">";
+    }
+    return x + "</rdf:Description></rdf:RDF></x:xmpmeta><?xpacket end=\"w\"?>";
+}
+
+static void jpeg_segment(std::string& out, uint8_t marker, const std::string& payload) {
+    out += '\xFF';
+    out += static_cast<char>(marker);
+    put_be16(out, static_cast<uint32_t>(payload.size() + 2));
+    out += payload;
+}
+
+static std::string make_jpeg(size_t size, size_t density, Rng& rng) {
+    density = std::min<size_t>(density, 1000);  // one APP1 holds < 64 KiB
+    std::string j = "\xFF\xD8";
+    jpeg_segment(j, 0xE0, std::string("JFIF\0\x01\x01\x00\x00\x01\x00\x01\x00\x00", 14));
+    jpeg_segment(j, 0xE1, std::string("Exif\0\0", 6) + make_tiff(density));
+    jpeg_segment(j, 0xE1, std::string("http://ns.adobe.com/xap/1.0/\0", 29) + make_xmp(density));
+
+    std::string iptc;
+    for (size_t i = 0; i < density; i++) {
+        std::string kw = "keyword" + std::to_string(i);
+        iptc += "\x1C\x02\x19";
+        put_be16(iptc, static_cast<uint32_t>(kw.size()));
+        iptc += kw;
+    }
+    std::string irb = std::string("Photoshop 3.0\0" "8BIM\x04\x04\0\0", 22);
+    put_be32(irb, static_cast<uint32_t>(iptc.size()));
+    irb += iptc;
+    if (iptc.size() & 1) irb += '\0';
+    jpeg_segment(j, 0xED, irb);
+    jpeg_segment(j, 0xFE, "generated by cleanmeta-bench");
+
+    jpeg_segment(j, 0xDB, std::string(1, '\0') + std::string(64, '\x01'));
+    jpeg_segment(j, 0xC0, std::string("\x08\x00\x40\x00\x40\x01\x01\x11\x00", 9));
+    std::string dht = std::string("\x00", 1) + std::string("\x00\x01", 2) + std::string(14, '\0') + '\0';
+    jpeg_segment(j, 0xC4, dht);
+    jpeg_segment(j, 0xDA, std::string("\x01\x01\x00\x00\x3F\x00", 6));
+
+    // Entropy-coded filler with 0xFF byte stuffing
+    while (j.size() + 2 < size) {
+        char b = static_cast<char>(rng.next() & 0xFF);
+        j += b;
+        if (b == '\xFF') j += '\0';
+    }
+    return j + "\xFF\xD9";
+}
+
+static void png_chunk(std::string& out, const char* type, const std::string& data) {
+    put_be32(out, static_cast<uint32_t>(data.size()));
+    size_t at = out.size();
+    out += std::string(type, 4) + data;
+    put_be32(out, crc32(out, at));
+}
+
+static std::string make_png(size_t size, size_t density, Rng& rng) {
+    std::string p = "\x89PNG\r\n\x1A\n";
+    std::string ihdr;
+    put_be32(ihdr, 256);
+    put_be32(ihdr, 256);
+    ihdr += std::string("\x08\x00\x00\x00\x00", 5);
+    png_chunk(p, "IHDR", ihdr);
+    png_chunk(p, "gAMA", std::string("\x00\x00\xB1\x8F", 4));
+    for (size_t i = 0; i < density; i++) {
+        png_chunk(p, "tEXt", "Comment" + std::to_string(i) + std::string(1, '\0') + "bench value " +
+                                 std::to_string(i));
+    }
+    png_chunk(p, "iTXt", std::string("XML:com.adobe.xmp\0\0\0\0\0", 22) + make_xmp(density));
+    png_chunk(p, "eXIf", make_tiff(density));
+    png_chunk(p, "tIME", std::string("\x07\xE6\x01\x02\x03\x04\x05", 7));
+
+    const size_t chunk = 64 * 1024;
+    while (p.size() + 12 + 12 < size) {
+        std::string data;
+        rng.fill(data, std::min(chunk, size - p.size() - 24));
+        png_chunk(p, "IDAT", data);
+    }
+    png_chunk(p, "IEND", "");
+    return p;
+}
+
+static std::string box(const char* type, const std::string& body) {
+    std::string b;
+    put_be32(b, static_cast<uint32_t>(body.size() + 8));
+    return b + std::string(type, 4) + body;
+}
+
+static std::string full_box(const char* type, uint8_t version, const std::string& body) {
+    std::string vf(4, '\0');
+    vf[0] = static_cast<char>(version);
+    return box(type, vf + body);
+}
+
+// Marks the one sample of a `heics` sequence; its `stco` entry must
+// still point at it after a clean
+static const char kSequenceChunk[] = "cleanmeta-sequence-chunk";
+
+// Minimal HEIF: one coded image item plus Exif and XMP items in mdat.
+// A sequence (msf1) also gets a `moov` after `meta` whose `stco`
+// holds the absolute offset of one sample chunk at the end of mdat.
+static std::string make_heic(size_t size, size_t density, Rng& rng, bool sequence = false) {
+    std::string exif = std::string("\0\0\0\0Exif\0\0", 10) + make_tiff(density);
+    std::string xmp = make_xmp(density);
+    size_t coded = size > 4096 ? size - 4096 : 1024;
+
+    auto infe = [](uint16_t id, const char* type, const std::string& extra) {
+        std::string b;
+        put_be16(b, id);
+        put_be16(b, 0);
+        b += std::string(type, 4);
+        b += '\0';  // item_name
+        return full_box("infe", 2, b + extra);
+    };
+    auto build_meta = [&](uint32_t mdat_data_at) {
+        std::string iinf;
+        put_be16(iinf, 3);
+        iinf += infe(1, "hvc1", "");
+        iinf += infe(2, "Exif", "");
+        iinf += infe(3, "mime", std::string("application/rdf+xml\0", 20));
+
+        std::string iloc = std::string("\x44\x00", 2);  // offset/length 4, base offset 0
+        put_be16(iloc, 3);
+        uint32_t at = mdat_data_at;
+        size_t lens[] = {coded, exif.size(), xmp.size()};
+        for (uint16_t id = 1; id <= 3; id++) {
+            put_be16(iloc, id);
+            put_be16(iloc, 0);  // data_reference_index
+            put_be16(iloc, 1);  // extent_count
+            put_be32(iloc, at);
+            put_be32(iloc, static_cast<uint32_t>(lens[id - 1]));
+            at += static_cast<uint32_t>(lens[id - 1]);
+        }
+
+        std::string cdsc;
+        for (uint16_t from = 2; from <= 3; from++) {
+            std::string r;
+            put_be16(r, from);
+            put_be16(r, 1);
+            put_be16(r, 1);
+            cdsc += box("cdsc", r);
+        }
+
+        std::string ispe;
+        put_be32(ispe, 4032);
+        put_be32(ispe, 3024);
+        std::string ipma;
+        put_be32(ipma, 1);
+        put_be16(ipma, 1);
+        ipma += '\x01';
+        ipma += '\x81';
+        std::string pitm;
+        put_be16(pitm, 1);
+
+        std::string hdlr = std::string(4, '\0') + "pict" + std::string(12, '\0') + '\0';
+        return full_box("meta", 0,
+                        full_box("hdlr", 0, hdlr) + full_box("pitm", 0, pitm) +
+                        full_box("iinf", 0, iinf) + full_box("iloc", 0, iloc) +
+                        full_box("iref", 0, cdsc) +
+                        box("iprp", box("ipco", full_box("ispe", 0, ispe)) + full_box("ipma", 0, ipma)));
+    };
+
+    auto build_moov = [](uint32_t chunk_at) {
+        std::string stco;
+        put_be32(stco, 1);
+        put_be32(stco, chunk_at);
+        return box("moov", box("trak", box("mdia", box("minf", box("stbl", full_box("stco", 0, stco))))));
+    };
+
+    std::string ftyp = sequence ? box("ftyp", std::string("msf1\0\0\0\0msf1mif1heic", 20))
+                                : box("ftyp", std::string("heic\0\0\0\0mif1heic", 16));
+    size_t meta_size = build_meta(0).size();
+    size_t moov_size = sequence ? build_moov(0).size() : 0;
+    uint32_t data_at = static_cast<uint32_t>(ftyp.size() + meta_size + moov_size + 8);
+    std::string payload;
+    rng.fill(payload, coded);
+    std::string mdat = payload + exif + xmp;
+    if (!sequence) return ftyp + build_meta(data_at) + box("mdat", mdat);
+    std::string moov = build_moov(static_cast<uint32_t>(data_at + mdat.size()));
+    return ftyp + build_meta(data_at) + moov + box("mdat", mdat + kSequenceChunk);
+}
+
+static std::string make_pdf(size_t size, size_t density, Rng& rng) {
+    std::vector<std::string> objs;
+    size_t pages = std::max<size_t>(1, size / (64 * 1024));
+    size_t per_page = size / pages;
+
+    std::string kids;
+    for (size_t i = 0; i < pages; i++) kids += std::to_string(5 + 2 * i) + " 0 R ";
+    std::string info = "<< /Title (cleanmeta bench) /Author (Bench Author) /Creator (cleanmeta-bench) "
+                       "/Producer (cleanmeta-bench) /CreationDate (D:20240101000000Z)";
+    for (size_t i = 0; i < density; i++) {
+        info += " /Custom" + std::to_string(i) + " (value " + std::to_string(i) + ")";
+    }
+    info += " >>";
+    std::string xmp = make_xmp(density);
+
+    objs.push_back("<< /Type /Catalog /Pages 2 0 R /Metadata 4 0 R >>");
+    objs.push_back("<< /Type /Pages /Count " + std::to_string(pages) + " /Kids [" + kids + "] >>");
+    objs.push_back(info);
+    objs.push_back("<< /Type /Metadata /Subtype /XML /Length " + std::to_string(xmp.size()) +
+                   " >>\nstream\n" + xmp + "\nendstream");
+    for (size_t i = 0; i < pages; i++) {
+        std::string content;
+        while (content.size() < per_page) {
+            content += "BT /F1 12 Tf 72 " + std::to_string(rng.next() % 700) + " Td (" +
+                       std::to_string(rng.next()) + ") Tj ET\n";
+        }
+        objs.push_back("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] /Contents " +
+                       std::to_string(6 + 2 * i) + " 0 R >>");
+        objs.push_back("<< /Length " + std::to_string(content.size()) + " >>\nstream\n" + content +
+                       "\nendstream");
+    }
+
+    std::string pdf = "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+    std::vector<size_t> offsets;
+    for (size_t i = 0; i < objs.size(); i++) {
+        offsets.push_back(pdf.size());
+        pdf += std::to_string(i + 1) + " 0 obj\n" + objs[i] + "\nendobj\n";
+    }
+    size_t xref = pdf.size();
+    pdf += "xref\n0 " + std::to_string(objs.size() + 1) + "\n0000000000 65535 f\r\n";
+    char line[32];
+    for (size_t off : offsets) {
+        std::snprintf(line, sizeof line, "%010zu 00000 n\r\n", off);
+        pdf += line;
+    }
+    pdf += "trailer\n<< /Size " + std::to_string(objs.size() + 1) +
+           " /Root 1 0 R /Info 3 0 R >>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+    return pdf;
+}
+
+// -------------------------------------------------------------
+// Benchmark configuration and results
+// -------------------------------------------------------------
+struct BenchConfig {
+    size_t files = 200;
+    size_t repeat = 1;  // runs per case
+    std::vector<size_t> sizes{64 * 1024, 1024 * 1024};
+    std::vector<size_t> densities{16, 256};
+    std::vector<size_t> threads{1, std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<std::string> formats{"jpeg", "png", "heic", "pdf"};
+    std::vector<PdfMode> pdf_modes{PdfMode::linearize, PdfMode::rewrite, PdfMode::preserve,
+                                   PdfMode::incremental};
+    std::vector<IoEngine> io{IoEngine::sync};
+    uint64_t seed = 1;
+    fs::path work_dir;
+    std::string json_out;
+    std::string baseline;
+    double threshold = 0.25;
+};
+
+struct BenchResult {
+    std::string format;
+    std::string mode;
+    std::string io = "sync";
+    size_t threads = 0;
+    size_t size = 0;
+    size_t density = 0;
+    size_t files = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    double files_per_s = 0;
+    double mb_per_s = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    double relative = 0;  // files/s over the plain copy's, median over --repeat
+
+    // Sync results keep the keys of baselines written before --io
+    std::string key() const {
+        return format + "/" + mode + (io == "sync" ? "" : "/" + io) + "/t" + std::to_string(threads) + "/s" +
+               std::to_string(size) + "/d" + std::to_string(density);
+    }
+};
+
+// A plain non-negative number; stoull alone would take "-1" and "12x"
+static uint64_t parse_count(const std::string& s) {
+    size_t used = 0;
+    if (s.empty() || !std::isdigit(static_cast<unsigned char>(s[0]))) throw std::invalid_argument(s);
+    uint64_t v = std::stoull(s, &used);
+    if (used != s.size()) throw std::invalid_argument(s);
+    return v;
+}
+
+static double parse_fraction(const std::string& s) {
+    size_t used = 0;
+    double v = std::stod(s, &used);
+    if (used != s.size() || v < 0 || v >= 1) throw std::invalid_argument(s);
+    return v;
+}
+
+static std::vector<size_t> parse_sizes(const std::string& list) {
+    std::vector<size_t> out;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t mult = 1;
+        char last = item.empty() ? '\0' : static_cast<char>(std::toupper(item.back()));
+        if (last == 'K') mult = 1024;
+        if (last == 'M') mult = 1024 * 1024;
+        if (mult != 1) item.pop_back();
+        out.push_back(parse_count(item) * mult);
+    }
+    return out;
+}
+
+static std::vector<std::string> parse_list(const std::string& list) {
+    std::vector<std::string> out;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) out.push_back(item);
+    return out;
+}
+
+static std::vector<fs::path> generate(const BenchConfig& cfg, const std::string& format, size_t size,
+                                      size_t density) {
+    fs::path dir = cfg.work_dir / "corpus" /
+                   (format + "-" + std::to_string(size) + "-" + std::to_string(density));
+    fs::create_directories(dir);
+    Rng rng{cfg.seed ^ (size * 31 + density)};
+    std::vector<fs::path> files;
+    for (size_t i = 0; i < cfg.files; i++) {
+        std::string data;
+        if (format == "jpeg") data = make_jpeg(size, density, rng);
+        else if (format == "png") data = make_png(size, density, rng);
+        else if (format == "heic") data = make_heic(size, density, rng);
+        else if (format == "heics") data = make_heic(size, density, rng, true);
+        else data = make_pdf(size, density, rng);
+        std::string ext = format == "jpeg" ? "jpg" : format == "heics" ? "heic" : format;
+        fs::path p = dir / ("f" + std::to_string(i) + "." + ext);
+        std::ofstream(p, std::ios::binary).write(data.data(), static_cast<std::streamsize>(data.size()));
+        files.push_back(p);
+    }
+    return files;
+}
+
+// The reference for `relative`: each file read whole and written to a
+// temp file that is renamed over the output, as a clean does, with no
+// parsing in between
+static double copy_files_per_s(const std::vector<fs::path>& files, size_t threads,
+                               const BenchConfig& cfg) {
+    const fs::path out_dir = cfg.work_dir / "out";
+    fs::create_directories(out_dir);
+    auto start = std::chrono::steady_clock::now();
+    {
+        BatchPool pool(threads);
+        for (auto& f : files) {
+            pool.submit([&, f](size_t) {
+                std::ifstream in(f, std::ios::binary);
+                std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+                fs::path out = default_output(f, out_dir);
+                fs::path tmp = out.string() + ".copy";
+                std::ofstream(tmp, std::ios::binary).write(data.data(), static_cast<std::streamsize>(data.size()));
+                fs::rename(tmp, out);
+            });
+        }
+        pool.wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? files.size() / seconds : 0;
+}
+
+// Files per clean_files call with an --io engine other than sync
+static const size_t kBenchBatch = 256;
+
+static BenchResult run_one(const std::vector<fs::path>& files, const std::string& format, PdfMode mode,
+                           IoEngine io, size_t threads, const BenchConfig& cfg) {
+    CleanOptions opt;
+    opt.pdf_mode = mode;
+    const fs::path out_dir = cfg.work_dir / "out";
+    fs::create_directories(out_dir);
+
+    std::vector<std::vector<double>> latencies(threads);
+    std::vector<size_t> errors(threads, 0);
+    uint64_t bytes = 0;
+    for (auto& f : files) bytes += fs::file_size(f);
+
+    std::atomic<bool> fell_back{false};
+    auto start = std::chrono::steady_clock::now();
+    {
+        BatchPool pool(threads);
+        if (io == IoEngine::sync) {
+            for (auto& f : files) {
+                pool.submit([&, f](size_t wk) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    bool ok = clean_file(f, default_output(f, out_dir), opt).ok;
+                    auto t1 = std::chrono::steady_clock::now();
+                    latencies[wk].push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+                    if (!ok) errors[wk]++;
+                });
+            }
+        } else {
+            // Latency is per file, from its first operation to its last
+            for (size_t at = 0; at < files.size(); at += kBenchBatch) {
+                pool.submit([&, at](size_t wk) {
+                    std::vector<BatchItem> items;
+                    for (size_t i = at; i < std::min(files.size(), at + kBenchBatch); i++) {
+                        items.push_back({files[i], default_output(files[i], out_dir), {}});
+                    }
+                    if (clean_files(items, opt, io) != io) fell_back = true;
+                    for (auto& it : items) {
+                        latencies[wk].push_back(it.result.elapsed_ns / 1e6);
+                        if (!it.result.ok) errors[wk]++;
+                    }
+                });
+            }
+        }
+        pool.wait();
+    }
+    if (fell_back) std::cerr << "[WARN] " << io_engine_name(io) << " is unavailable here; ran sync\n";
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    BenchResult r;
+    for (size_t i = 0; i < threads; i++) {
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+        r.errors += errors[i];
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&](double q) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(q * all.size()))];
+    };
+    r.format = format;
+    r.mode = format == "pdf" ? pdf_mode_name(mode) : "native";
+    r.io = fell_back ? "sync" : io_engine_name(io);
+    r.threads = threads;
+    r.files = files.size();
+    r.seconds = seconds;
+    r.files_per_s = seconds > 0 ? files.size() / seconds : 0;
+    r.mb_per_s = seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+    r.p50_ms = pct(0.50);
+    r.p99_ms = pct(0.99);
+    return r;
+}
+
+static std::string to_json(const std::vector<BenchResult>& results, const BenchConfig& cfg) {
+    std::ostringstream o;
+    o << "{\n  \"version\": \"" << CLEANMETA_VERSION << "\",\n  \"seed\": " << cfg.seed
+      << ",\n  \"files_per_case\": " << cfg.files << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        o << "    {\"format\": \"" << r.format << "\", \"mode\": \"" << r.mode
+          << "\", \"io\": \"" << r.io << "\", \"threads\": " << r.threads << ", \"size\": " << r.size
+          << ", \"density\": " << r.density << ", \"files\": " << r.files
+          << ", \"errors\": " << r.errors << ", \"seconds\": " << r.seconds
+          << ", \"files_per_s\": " << r.files_per_s << ", \"mb_per_s\": " << r.mb_per_s
+          << ", \"p50_ms\": " << r.p50_ms << ", \"p99_ms\": " << r.p99_ms
+          << ", \"relative\": " << r.relative << "}"
+          << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    o << "  ]\n}\n";
+    return o.str();
+}
+
+// Reads `relative` from the flat result objects written by to_json;
+// results without one (older files) are not compared
+static std::map<std::string, double> read_baseline(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+
+    auto field = [](const std::string& obj, const std::string& name) {
+        size_t at = obj.find("\"" + name + "\":");
+        if (at == std::string::npos) return std::string();
+        at = obj.find_first_not_of(" \"", at + name.size() + 3);
+        size_t end = obj.find_first_of(",}\"", at);
+        return obj.substr(at, end - at);
+    };
+
+    std::map<std::string, double> out;
+    size_t pos = text.find("\"results\"");
+    while (pos != std::string::npos && (pos = text.find('{', pos)) != std::string::npos) {
+        size_t end = text.find('}', pos);
+        std::string obj = text.substr(pos, end - pos + 1);
+        BenchResult r;
+        r.format = field(obj, "format");
+        r.mode = field(obj, "mode");
+        if (obj.find("\"io\":") != std::string::npos) r.io = field(obj, "io");
+        r.threads = std::stoul(field(obj, "threads"));
+        r.size = std::stoul(field(obj, "size"));
+        r.density = std::stoul(field(obj, "density"));
+        std::string rel = field(obj, "relative");
+        if (!rel.empty()) out[r.key()] = std::stod(rel);
+        pos = end;
+    }
+    return out;
+}
+
+static void usage(const char* prog) {
+    std::cout <<
+"cleanmeta-bench — measure cleaning throughput on a synthetic corpus\n\n"
+"Usage:\n"
+"  " << prog << " [options]\n\n"
+"Options:\n"
+"  --files N             Files per case (default 200)\n"
+"  --repeat N            Run each case N times: fastest files/s, median ratio\n"
+"                        to the copy (default 1)\n"
+"  --sizes LIST          File sizes, e.g. 64K,1M (default 64K,1M)\n"
+"  --densities LIST      Metadata entries per file (default 16,256)\n"
+"  --threads LIST        Worker counts (default 1,<cores>)\n"
+"  --formats LIST        jpeg,png,heic,pdf (default all), or heics for a\n"
+"                        HEIF image sequence\n"
+"  --pdf-modes LIST      PDF modes to time (default all)\n"
+"  --io LIST             I/O engines: sync,uring (default sync)\n"
+"  --seed N              Corpus seed (default 1)\n"
+"  --dir DIR             Work directory (default: a fresh temp dir)\n"
+"  --json FILE           Write results to FILE instead of stdout\n"
+"  --baseline FILE       Compare throughput relative to a plain copy against a\n"
+"                        previous --json run; exits 3 on a regression\n"
+"  --threshold F         Allowed regression vs baseline (default 0.25)\n"
+"  --quick               Small corpus for CI: 50 files, 64K, density 16, 1 and 4\n"
+"                        threads, 5 runs each\n"
+"  -h, --help            Show help\n";
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg;
+    std::string a;
+    try {
+        for (int i = 1; i < argc; i++) {
+            a = argv[i];
+            if (a == "-h" || a == "--help") { usage(argv[0]); return 0; }
+            else if (a == "--files") cfg.files = parse_count(next_arg(argc, argv, i));
+            else if (a == "--repeat") cfg.repeat = std::max<size_t>(1, parse_count(next_arg(argc, argv, i)));
+            else if (a == "--sizes") cfg.sizes = parse_sizes(next_arg(argc, argv, i));
+            else if (a == "--densities") cfg.densities = parse_sizes(next_arg(argc, argv, i));
+            else if (a == "--threads") cfg.threads = parse_sizes(next_arg(argc, argv, i));
+            else if (a == "--formats") cfg.formats = parse_list(next_arg(argc, argv, i));
+            else if (a == "--pdf-modes") {
+                cfg.pdf_modes.clear();
+                for (auto& m : parse_list(next_arg(argc, argv, i))) {
+                    PdfMode mode;
+                    if (!parse_pdf_mode(m, mode)) { std::cerr << "unknown PDF mode: " << m << "\n"; return 1; }
+                    cfg.pdf_modes.push_back(mode);
+                }
+            }
+            else if (a == "--io") {
+                cfg.io.clear();
+                for (auto& name : parse_list(next_arg(argc, argv, i))) {
+                    IoEngine e;
+                    if (!parse_io_engine(name, e)) { std::cerr << "unknown I/O engine: " << name << "\n"; return 1; }
+                    cfg.io.push_back(e);
+                }
+            }
+            else if (a == "--seed") cfg.seed = parse_count(next_arg(argc, argv, i));
+            else if (a == "--dir") cfg.work_dir = next_arg(argc, argv, i);
+            else if (a == "--json") cfg.json_out = next_arg(argc, argv, i);
+            else if (a == "--baseline") cfg.baseline = next_arg(argc, argv, i);
+            else if (a == "--threshold") cfg.threshold = parse_fraction(next_arg(argc, argv, i));
+            else if (a == "--quick") {
+                cfg.files = 50;
+                cfg.sizes = {64 * 1024};
+                cfg.densities = {16};
+                cfg.threads = {1, 4};
+                cfg.repeat = 5;
+            }
+            else { usage(argv[0]); return 1; }
+        }
+    } catch (const std::exception&) {
+        // next_arg, or a number that doesn't parse
+        std::cerr << "missing or bad value for " << a << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    bool own_dir = cfg.work_dir.empty();
+    if (own_dir) {
+        cfg.work_dir = fs::temp_directory_path() /
+                       ("cleanmeta-bench-" + std::to_string(std::chrono::steady_clock::now()
+                                                                .time_since_epoch().count()));
+    }
+    fs::create_directories(cfg.work_dir);
+    cleanmeta_init();
+
+    std::vector<BenchResult> results;
+    for (auto& format : cfg.formats) {
+        for (size_t size : cfg.sizes) {
+            for (size_t density : cfg.densities) {
+                auto files = generate(cfg, format, size, density);
+                std::vector<PdfMode> modes = format == "pdf" ? cfg.pdf_modes
+                                                              : std::vector<PdfMode>{PdfMode::linearize};
+                for (PdfMode mode : modes) {
+                    for (IoEngine io : cfg.io) {
+                        for (size_t threads : cfg.threads) {
+                            // Each run is paired with a copy just before it, so
+                            // drift on the machine moves both sides of a ratio
+                            BenchResult r;
+                            std::vector<double> ratios;
+                            for (size_t k = 0; k < cfg.repeat; k++) {
+                                double copy = copy_files_per_s(files, threads, cfg);
+                                BenchResult run = run_one(files, format, mode, io, threads, cfg);
+                                if (copy > 0) ratios.push_back(run.files_per_s / copy);
+                                size_t errors = std::max(r.errors, run.errors);
+                                if (k == 0 || run.files_per_s > r.files_per_s) r = run;
+                                r.errors = errors;
+                            }
+                            std::sort(ratios.begin(), ratios.end());
+                            r.size = size;
+                            r.density = density;
+                            r.relative = ratios.empty() ? 0 : ratios[ratios.size() / 2];
+                            std::cerr << r.key() << ": " << r.files_per_s << " files/s, " << r.mb_per_s
+                                      << " MB/s, " << r.relative << "x copy, p99 " << r.p99_ms << " ms"
+                                      << (r.errors ? ", " + std::to_string(r.errors) + " errors" : "") << "\n";
+                            results.push_back(r);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (own_dir) fs::remove_all(cfg.work_dir);
+
+    std::string json = to_json(results, cfg);
+    if (cfg.json_out.empty()) std::cout << json;
+    else std::ofstream(cfg.json_out) << json;
+
+    // Files that fail fast would otherwise pass as a speedup
+    size_t failed = 0;
+    for (auto& r : results) {
+        if (!r.errors) continue;
+        std::cerr << "[ERROR] " << r.key() << ": " << r.errors << " of " << r.files << " files failed\n";
+        failed++;
+    }
+    if (failed) return 4;
+
+    if (cfg.baseline.empty()) return 0;
+    auto base = read_baseline(cfg.baseline);
+    int regressions = 0;
+    for (auto& r : results) {
+        auto it = base.find(r.key());
+        if (it == base.end()) continue;
+        double floor = it->second * (1.0 - cfg.threshold);
+        if (r.relative < floor) {
+            std::cerr << "[REGRESSION] " << r.key() << ": " << r.relative << "x copy < " << floor
+                      << " (baseline " << it->second << ")\n";
+            regressions++;
+        }
+    }
+    return regressions ? 3 : 0;
+}
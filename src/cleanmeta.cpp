@@ -0,0 +1,1119 @@
+#include "cleanmeta.h"
+
+#include <exiv2/exiv2.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_io.h"
+#include "format_sniff.h"
+#include "mem_budget.h"
+#include "pdf_clean.h"
+#include "trace.h"
+#include "uring_io.h"
+
+// -------------------------------------------------------------
+// Sinks
+// -------------------------------------------------------------
+void ByteSink::write_at(uint64_t, const void*, size_t) {
+    throw std::system_error(ESPIPE, std::generic_category(), "sink is not seekable");
+}
+
+void VectorSink::write(const void* data, size_t n) {
+    const auto* s = static_cast<const uint8_t*>(data);
+    out_.insert(out_.end(), s, s + n);
+}
+
+void VectorSink::write_at(uint64_t off, const void* data, size_t n) {
+    if (off > out_.size() || n > out_.size() - off) {
+        throw std::system_error(EINVAL, std::generic_category(), "write_at past the end");
+    }
+    std::memcpy(out_.data() + off, data, n);
+}
+
+FdSink::FdSink(int fd) : fd_(fd) {
+    struct stat st {};
+    off_t at = ::lseek(fd, 0, SEEK_CUR);
+    if (at >= 0 && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) base_ = at;
+}
+
+void FdSink::write(const void* data, size_t n) {
+    const auto* s = static_cast<const uint8_t*>(data);
+    while (n > 0) {
+        ssize_t k = ::write(fd_, s, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "write");
+        s += k;
+        n -= static_cast<size_t>(k);
+    }
+}
+
+void FdSink::write_at(uint64_t off, const void* data, size_t n) {
+    if (base_ < 0) {
+        ByteSink::write_at(off, data, n);
+        return;
+    }
+    const auto* s = static_cast<const uint8_t*>(data);
+    off += static_cast<uint64_t>(base_);
+    while (n > 0) {
+        ssize_t k = ::pwrite(fd_, s, n, static_cast<off_t>(off));
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "pwrite");
+        s += k;
+        off += static_cast<uint64_t>(k);
+        n -= static_cast<size_t>(k);
+    }
+}
+
+// -------------------------------------------------------------
+// Shared helpers
+// -------------------------------------------------------------
+void cleanmeta_init() {
+    Exiv2::XmpParser::initialize();
+}
+
+fs::path default_output(const fs::path& in, const fs::path& out_dir) {
+    if (!out_dir.empty()) {
+        fs::create_directories(out_dir);
+        return out_dir / in.filename();
+    }
+    auto out = in;
+    out.replace_filename(in.stem().string() + ".clean" + in.extension().string());
+    return out;
+}
+
+static uint64_t elapsed_since(std::chrono::steady_clock::time_point t0) {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - t0).count());
+}
+
+static size_t exiv2_tag_count(Exiv2::Image& image) {
+    return image.exifData().count() + image.iptcData().size() + image.xmpData().count();
+}
+
+// -------------------------------------------------------------
+// Retention policy
+// -------------------------------------------------------------
+struct ExifGroup {
+    const char* name;  // Exiv2's group name
+    ExifIfd ifd;
+};
+
+static const ExifGroup kExifGroups[] = {
+    {"Image", ExifIfd::image},
+    {"Photo", ExifIfd::photo},
+    {"GPSInfo", ExifIfd::gps},
+    {"Iop", ExifIfd::interop},
+};
+
+struct KeepAlias {
+    const char* name;
+    const char* keys;  // space-separated canonical entries
+};
+
+static const KeepAlias kKeepAliases[] = {
+    {"orientation", "Exif.Image.0x0112"},
+    // InterColorProfile, WhitePoint, PrimaryChromaticities, ColorSpace, Gamma, InteroperabilityIndex
+    {"icc", "Exif.Image.0x8773 Exif.Image.0x013e Exif.Image.0x013f Exif.Photo.0xa001 Exif.Photo.0xa500 "
+            "Exif.Iop.0x0001"},
+    {"copyright", "Exif.Image.0x8298"},
+};
+
+static const KeepPolicy& keep_policy(const CleanOptions& opt) {
+    static const KeepPolicy kKeepNothing;
+    return opt.keep ? *opt.keep : kKeepNothing;
+}
+
+static bool exif_group(const std::string& name, ExifIfd& ifd) {
+    for (const auto& g : kExifGroups) {
+        if (name == g.name) {
+            ifd = g.ifd;
+            return true;
+        }
+    }
+    return false;
+}
+
+// "Exif.Group.Name" or "Exif.Group.0xTTTT" to its IFD and tag
+static bool parse_exif_key(const std::string& key, ExifIfd& ifd, uint16_t& tag) {
+    size_t dot = key.find('.', 5);
+    if (dot == std::string::npos || !exif_group(key.substr(5, dot - 5), ifd)) return false;
+    std::string name = key.substr(dot + 1);
+    if (name.size() > 2 && name.size() <= 6 && name.compare(0, 2, "0x") == 0) {
+        char* end;
+        unsigned long v = std::strtoul(name.c_str() + 2, &end, 16);
+        if (*end != '\0') return false;
+        tag = static_cast<uint16_t>(v);
+        return true;
+    }
+    try {
+        tag = Exiv2::ExifKey(key).tag();
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+static void add_exif_entry(KeepPolicy& out, ExifIfd ifd, uint16_t tag) {
+    char buf[32];
+    const char* group = "";
+    for (const auto& g : kExifGroups) {
+        if (g.ifd == ifd) group = g.name;
+    }
+    std::snprintf(buf, sizeof buf, "Exif.%s.0x%04x", group, tag);
+    out.exif[static_cast<size_t>(ifd)].set(tag);
+    out.entries.push_back(buf);
+    out.keeps_exif = true;
+}
+
+bool compile_keep_policy(const std::vector<std::string>& entries, KeepPolicy& out, std::string& error) {
+    out = KeepPolicy();
+    std::vector<std::string> todo(entries.rbegin(), entries.rend());
+    while (!todo.empty()) {
+        std::string e = todo.back();
+        todo.pop_back();
+        size_t b = e.find_first_not_of(" \t"), end = e.find_last_not_of(" \t");
+        if (b == std::string::npos) continue;
+        e = e.substr(b, end - b + 1);
+
+        bool alias = false;
+        for (const auto& a : kKeepAliases) {
+            if (e != a.name) continue;
+            std::string keys = a.keys;
+            for (size_t at = 0; at < keys.size();) {
+                size_t sp = keys.find(' ', at);
+                if (sp == std::string::npos) sp = keys.size();
+                todo.push_back(keys.substr(at, sp - at));
+                at = sp + 1;
+            }
+            alias = true;
+        }
+        if (alias) continue;
+
+        ExifIfd ifd;
+        uint16_t tag;
+        if (e.compare(0, 5, "Exif.") == 0 && parse_exif_key(e, ifd, tag)) {
+            add_exif_entry(out, ifd, tag);
+        } else if ((e.compare(0, 5, "Iptc.") == 0 || e.compare(0, 4, "Xmp.") == 0) &&
+                   std::count(e.begin(), e.end(), '.') >= 2) {
+            out.keys.push_back(e);
+            out.entries.push_back(e);
+        } else {
+            error = "can't keep '" + e + "'";
+            return false;
+        }
+    }
+    for (auto* v : {&out.keys, &out.entries}) {
+        std::sort(v->begin(), v->end());
+        v->erase(std::unique(v->begin(), v->end()), v->end());
+    }
+    if (out.entries.empty()) return true;
+    uint64_t h = 0xcbf29ce484222325ull;  // FNV-1a
+    for (const auto& e : out.entries) {
+        for (unsigned char c : e + "\n") {
+            h ^= c;
+            h *= 0x100000001b3ull;
+        }
+    }
+    out.hash = h ? h : 1;
+    return true;
+}
+
+bool read_keep_file(const fs::path& p, std::vector<std::string>& entries, std::string& error) {
+    std::ifstream f(p);
+    if (!f) {
+        error = "cannot read " + p.string();
+        return false;
+    }
+    std::string line;
+    while (std::getline(f, line)) {
+        line = line.substr(0, line.find('#'));
+        for (size_t at = 0; at <= line.size();) {
+            size_t comma = line.find(',', at);
+            if (comma == std::string::npos) comma = line.size();
+            entries.push_back(line.substr(at, comma - at));
+            at = comma + 1;
+        }
+    }
+    return true;
+}
+
+// Exiv2 reports Exif tags by group name and tag ID
+static bool exiv2_keeps(const KeepPolicy& keep, const Exiv2::Exifdatum& d) {
+    ExifIfd ifd;
+    return keep.keeps_exif && exif_group(d.groupName(), ifd) && keep.keeps(ifd, d.tag());
+}
+
+// Clears every Exif, IPTC and XMP tag the policy doesn't keep;
+// returns how many went
+static size_t exiv2_clear(Exiv2::Image& image, const KeepPolicy& keep) {
+    {
+        TraceSpan span("exiv2.read");
+        image.readMetadata();
+    }
+    size_t before = exiv2_tag_count(image);
+
+    TraceSpan span("exiv2.write");
+    if (keep.empty()) {
+        image.exifData().clear();
+        image.iptcData().clear();
+        image.xmpData().clear();
+    } else {
+        auto& exif = image.exifData();
+        for (auto it = exif.begin(); it != exif.end();) it = exiv2_keeps(keep, *it) ? std::next(it) : exif.erase(it);
+        auto& iptc = image.iptcData();
+        for (auto it = iptc.begin(); it != iptc.end();) it = keep.keeps_key(it->key()) ? std::next(it) : iptc.erase(it);
+        auto& xmp = image.xmpData();
+        for (auto it = xmp.begin(); it != xmp.end();) it = keep.keeps_key(it->key()) ? std::next(it) : xmp.erase(it);
+    }
+    image.writeMetadata();
+    return before - exiv2_tag_count(image);
+}
+
+// Native handlers drop IPTC and XMP whole, so a policy keeping any
+// of their keys leaves the file to Exiv2
+static bool native_strip(const FormatHandler& fmt, const KeepPolicy& keep) {
+    return fmt.strip && keep.keys.empty();
+}
+
+static std::string pdf_error_text(const PdfError& e) {
+    return pdf_error_name(e.code) + (e.message.empty() ? "" : " (" + e.message + ")");
+}
+
+// -------------------------------------------------------------
+// Memory charges (--max-mem)
+//
+// Rough peaks per engine, erring high. A native handler holds its
+// input and output buffers; Exiv2 reads the whole file and builds
+// the rewritten one in a MemIo; qpdf's linearizer keeps the object
+// graph and hint tables, and a rewrite the decoded streams it is
+// writing out.
+// -------------------------------------------------------------
+static uint64_t exiv2_cost(uint64_t size) {
+    return 2 * size + kIoBufferSize;
+}
+
+static uint64_t pdf_cost(uint64_t size, const CleanOptions& opt) {
+    PdfMode mode = opt.pdf_mode;
+    if (mode == PdfMode::incremental && opt.pdf_squash) mode = PdfMode::rewrite;
+    switch (mode) {
+        case PdfMode::linearize: return 3 * size + kIoBufferSize;
+        case PdfMode::rewrite:   return 2 * size + kIoBufferSize;
+        default:                 return size + kIoBufferSize;
+    }
+}
+
+// What a clean of `size` bytes of `fmt` starts out charging; the
+// image paths resize() to exiv2_cost when they fall back
+static uint64_t memory_cost(const FormatHandler& fmt, uint64_t size, const CleanOptions& opt) {
+    if (fmt.kind == FormatKind::pdf) return pdf_cost(size, opt);
+    if (native_strip(fmt, keep_policy(opt)) || (opt.scrub && fmt.scrub)) return 2 * kIoBufferSize;
+    return exiv2_cost(size);
+}
+
+// -------------------------------------------------------------
+// Files: in-place scrub when asked for and the format allows it,
+// else the native handler, else Exiv2 / qpdf
+// -------------------------------------------------------------
+static void clean_image_path(const fs::path& in, const fs::path& target, const CleanOptions& opt,
+                             const FormatHandler& fmt, MemoryCharge& charge, CleanResult& res) {
+    const KeepPolicy& keep = keep_policy(opt);
+    if (opt.scrub && !keep.empty()) {
+        res.note = "can't keep tags when scrubbing in place; rewriting";
+    } else if (opt.scrub) {
+        // The scrub writes into the original inode, so the backup
+        // can't be a hard link
+        if (opt.backup && fmt.scrub) make_backup(in, false);
+        StripStats st;
+        if (fmt.scrub && scrub_file(in, fmt.scrub, st)) {
+            res.method = CleanMethod::scrub;
+            res.segments_removed = st.segments_removed;
+            res.bytes_removed = st.bytes_removed;
+            res.ok = true;
+            return;
+        }
+        res.note = fmt.scrub ? "has a layout that can't be scrubbed in place; rewriting"
+                             : "can't be scrubbed in place; rewriting";
+    }
+
+    // Every image path below renames a new file over the target
+    if (opt.in_place && opt.backup) make_backup(in, true);
+
+    StripStats st;
+    if (native_strip(fmt, keep) &&
+        filter_file(in, target, [&](InFile& i, OutFile& o) { return fmt.strip(i, o, keep, st); })) {
+        res.method = CleanMethod::native;
+        res.segments_removed = st.segments_removed;
+        res.bytes_removed = st.bytes_removed;
+        res.ok = true;
+        return;
+    }
+    // Not something the native handlers understand: let Exiv2 try
+    charge.resize(exiv2_cost(res.bytes_in));
+
+    // Exiv2 edits a file where it lies, so give it a temp copy
+    bool opened = edit_file(in, target, [&](const fs::path& tmp) {
+        auto image = Exiv2::ImageFactory::open(tmp.string());
+        if (!image) {
+            return false;
+        }
+        res.tags_removed = exiv2_clear(*image, keep);
+        return true;
+    });
+    if (!opened) {
+        res.error = "cannot open";
+        return;
+    }
+    res.method = CleanMethod::exiv2;
+    res.ok = true;
+}
+
+// Reports a document qpdf had to repair to read
+static void note_pdf_warnings(const PdfResult& pr, CleanResult& res) {
+    if (!pr.warnings) return;
+    if (!res.note.empty()) res.note += "; ";
+    res.note += "is damaged; repaired " + std::to_string(pr.warnings) +
+                (pr.warnings == 1 ? " problem" : " problems");
+}
+
+static void clean_pdf_path(const fs::path& in, const fs::path& target, const CleanOptions& opt,
+                           CleanResult& res) {
+    PdfMode mode = opt.pdf_mode;
+    if (mode == PdfMode::incremental && opt.pdf_squash) mode = PdfMode::rewrite;
+    if (opt.scrub) res.note = "can't be scrubbed in place; rewriting";
+
+    if (opt.in_place && opt.backup) make_backup(in, true);
+
+    PdfResult pr = clean_pdf_file(in, target, mode);
+    res.method = CleanMethod::qpdf;
+    res.pdf_mode = pr.mode;
+    note_pdf_warnings(pr, res);
+    if (pr.error) {
+        res.error = pdf_error_text(pr.error);
+        return;
+    }
+    res.ok = true;
+}
+
+CleanResult clean_file(const fs::path& in, const fs::path& out, const CleanOptions& opt) {
+    auto t0 = std::chrono::steady_clock::now();
+    CleanResult res;
+    res.policy = keep_policy(opt).hash;
+    try {
+        const FormatHandler* fmt = sniff_format(in);
+        if (!fmt) {
+            res.error = kUnsupportedFormat;
+        } else {
+            res.format = fmt->name;
+            trace_set_format(fmt->name);
+            res.bytes_in = fs::file_size(in);
+            fs::path target = opt.in_place ? in : out;
+            MemoryCharge charge(memory_cost(*fmt, res.bytes_in, opt));
+            if (fmt->kind == FormatKind::pdf) clean_pdf_path(in, target, opt, res);
+            else clean_image_path(in, target, opt, *fmt, charge, res);
+            if (res.ok) res.bytes_out = fs::file_size(target);
+        }
+    } catch (const std::exception& e) {
+        res.ok = false;
+        res.error = e.what();
+    }
+    res.elapsed_ns = elapsed_since(t0);
+    return res;
+}
+
+// -------------------------------------------------------------
+// Memory
+//
+// Native handlers read the caller's buffer in place and stream
+// into the sink. A handler that rejects the input after output has
+// reached the sink can't fall back any more; in practice rejection
+// comes from the headers, long before the first 256 KiB flush.
+// -------------------------------------------------------------
+static void clean_image_buffer(const uint8_t* data, size_t size, ByteSink& sink, const FormatHandler& fmt,
+                               const KeepPolicy& keep, MemoryCharge& charge, CleanResult& res) {
+    if (native_strip(fmt, keep)) {
+        // Output that is patched at the end is staged when the sink can't seek
+        std::vector<uint8_t> staged;
+        VectorSink stage(staged);
+        ByteSink& to = fmt.patches_output && !sink.seekable() ? static_cast<ByteSink&>(stage) : sink;
+
+        InFile in;
+        in.open(data, size);
+        OutFile out;
+        out.open(to);
+        StripStats st;
+        bool stripped;
+        {
+            TraceSpan span("strip");
+            stripped = fmt.strip(in, out, keep, st);
+            if (stripped) out.close();
+        }
+        if (stripped) {
+            if (&to == &stage) sink.write(staged.data(), staged.size());
+            res.method = CleanMethod::native;
+            res.segments_removed = st.segments_removed;
+            res.bytes_removed = st.bytes_removed;
+            res.bytes_out = out.written();
+            res.ok = true;
+            return;
+        }
+        if (out.flushed() > 0) {
+            res.error = std::string("malformed ") + fmt.name + " after output had started";
+            return;
+        }
+    }
+
+    charge.resize(exiv2_cost(size));
+    auto image = Exiv2::ImageFactory::open(data, size);
+    if (!image) {
+        res.error = "cannot open";
+        return;
+    }
+    res.tags_removed = exiv2_clear(*image, keep);
+    Exiv2::BasicIo& io = image->io();
+    io.open();
+    res.bytes_out = io.size();
+    sink.write(io.mmap(), io.size());
+    io.munmap();
+    io.close();
+    res.method = CleanMethod::exiv2;
+    res.ok = true;
+}
+
+// Counts what reaches the sink, for bytes_out of the qpdf path
+class CountingSink : public ByteSink {
+public:
+    explicit CountingSink(ByteSink& to) : to_(to) {}
+    void write(const void* data, size_t n) override {
+        to_.write(data, n);
+        count += n;
+    }
+    uint64_t count = 0;
+
+private:
+    ByteSink& to_;
+};
+
+// clean_buffer under a charge that already covers `held` bytes of
+// the caller's (a mapping or a drained pipe)
+static CleanResult clean_buffer_charged(const void* data, size_t size, ByteSink& sink, const CleanOptions& opt,
+                                        uint64_t held) {
+    auto t0 = std::chrono::steady_clock::now();
+    CleanResult res;
+    res.bytes_in = size;
+    res.policy = keep_policy(opt).hash;
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    try {
+        const FormatHandler* fmt = sniff_format(bytes, std::min(size, kSniffBytes), nullptr);
+        // Output staged for a sink that can't seek costs its size again
+        MemoryCharge charge(held + (fmt ? memory_cost(*fmt, size, opt) : 0) +
+                            (fmt && fmt->patches_output && !sink.seekable() ? size : 0));
+        if (!fmt) {
+            res.error = kUnsupportedFormat;
+        } else if (fmt->kind == FormatKind::pdf) {
+            res.format = fmt->name;
+            PdfMode mode = opt.pdf_mode;
+            if (mode == PdfMode::incremental && opt.pdf_squash) mode = PdfMode::rewrite;
+            CountingSink counted(sink);
+            PdfResult pr = clean_pdf_buffer(bytes, size, counted, mode);
+            res.method = CleanMethod::qpdf;
+            res.pdf_mode = pr.mode;
+            res.bytes_out = counted.count;
+            note_pdf_warnings(pr, res);
+            if (pr.error) res.error = pdf_error_text(pr.error);
+            else res.ok = true;
+        } else {
+            res.format = fmt->name;
+            clean_image_buffer(bytes, size, sink, *fmt, keep_policy(opt), charge, res);
+        }
+    } catch (const std::exception& e) {
+        res.ok = false;
+        res.error = e.what();
+    }
+    res.elapsed_ns = elapsed_since(t0);
+    return res;
+}
+
+CleanResult clean_buffer(const void* data, size_t size, ByteSink& sink, const CleanOptions& opt) {
+    return clean_buffer_charged(data, size, sink, opt, 0);
+}
+
+// Appends everything left in `fd` to `data`
+static void read_to_end(int fd, std::vector<uint8_t>& data) {
+    for (;;) {
+        size_t at = data.size();
+        data.resize(at + kIoBufferSize);
+        ssize_t k = ::read(fd, data.data() + at, kIoBufferSize);
+        int err = errno;
+        data.resize(at + static_cast<size_t>(std::max<ssize_t>(k, 0)));
+        if (k < 0 && err == EINTR) continue;
+        if (k < 0) throw std::system_error(err, std::generic_category(), "read");
+        if (k == 0) return;
+    }
+}
+
+// -------------------------------------------------------------
+// Streams
+//
+// A pipe or socket whose format has a forward-only handler is
+// cleaned as it arrives: output reaches the sink while the input
+// is still coming in, and memory use is the I/O buffer. Everything
+// else (HEIF, PDF, the Exiv2 fallback) needs the whole input, so it
+// is read to EOF and cleaned as a buffer. A handler that rejects
+// the input within the first buffer still gets that fallback.
+// -------------------------------------------------------------
+static CleanResult clean_stream(int fd, ByteSink& sink, const CleanOptions& opt) {
+    InFile in;
+    in.attach(fd);
+    const uint8_t* head;
+    size_t n = in.peek(head, kSniffBytes);
+    const FormatHandler* fmt = sniff_format(head, n, nullptr);
+
+    const KeepPolicy& keep = keep_policy(opt);
+    if (fmt && native_strip(*fmt, keep) && !fmt->random_access && (!fmt->patches_output || sink.seekable())) {
+        MemoryCharge charge(2 * kIoBufferSize);
+        CleanResult res;
+        res.format = fmt->name;
+        res.policy = keep.hash;
+        OutFile out;
+        out.open(sink);
+        StripStats st;
+        bool stripped;
+        {
+            TraceSpan span("strip");
+            stripped = fmt->strip(in, out, keep, st);
+            if (stripped) out.close();
+        }
+        if (stripped) {
+            res.method = CleanMethod::native;
+            res.segments_removed = st.segments_removed;
+            res.bytes_removed = st.bytes_removed;
+            res.bytes_in = in.offset();
+            res.bytes_out = out.written();
+            res.ok = true;
+            return res;
+        }
+        if (out.flushed() > 0 || !in.replayable()) {
+            res.error = std::string("malformed ") + fmt->name + " after output had started";
+            return res;
+        }
+    }
+
+    const uint8_t* p;
+    size_t k = in.buffered(p);
+    std::vector<uint8_t> data(p, p + k);
+    read_to_end(fd, data);
+    // The size of a pipe is only known here, once it is in memory
+    return clean_buffer_charged(data.data(), data.size(), sink, opt, data.size());
+}
+
+CleanResult clean_fd(int fd, ByteSink& sink, const CleanOptions& opt) {
+    auto t0 = std::chrono::steady_clock::now();
+    struct stat st {};
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t size = static_cast<size_t>(st.st_size);
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // The mapping's pages count once they are read
+            CleanResult res = clean_buffer_charged(map, size, sink, opt, size);
+            ::munmap(map, size);
+            return res;
+        }
+    }
+
+    CleanResult res;
+    res.policy = keep_policy(opt).hash;
+    try {
+        res = clean_stream(fd, sink, opt);
+    } catch (const std::exception& e) {
+        res.ok = false;
+        res.error = e.what();
+    }
+    res.elapsed_ns = elapsed_since(t0);
+    return res;
+}
+
+// -------------------------------------------------------------
+// Batches (clean_files)
+//
+// With IoEngine::uring each thread keeps one ring and kUringSlots
+// slots, each owning a registered input and output buffer of
+// kUringSlotSize. A slot takes one file through
+//
+//     statx + openat -> read -> [strip in memory] -> close + openat
+//     temp -> write -> close, linked to renameat temp -> target
+//
+// and every step of every slot waits in the same io_uring_enter, so
+// a thread parks in one syscall however many files are in flight.
+// The strip runs on the slot's buffers through the native handler.
+// Anything the slots can't hold or the handlers don't clean is
+// passed to clean_file once the ring is idle.
+// -------------------------------------------------------------
+static const size_t kUringSlots = 64;
+static const size_t kUringSlotSize = 128 * 1024;
+static const unsigned kUringEntries = 256;
+static const uint64_t kUringBufferBytes = kUringSlots * 2 * kUringSlotSize;
+
+// Writes into a slot's output buffer; throws once it is full, and
+// the file then goes to clean_file
+class SlotSink : public ByteSink {
+public:
+    SlotSink(uint8_t* buf, size_t cap) : buf_(buf), cap_(cap) {}
+    void write(const void* data, size_t n) override {
+        if (n > cap_ - size) throw std::system_error(EFBIG, std::generic_category(), "slot full");
+        std::memcpy(buf_ + size, data, n);
+        size += n;
+    }
+    bool seekable() const override { return true; }
+    void write_at(uint64_t off, const void* data, size_t n) override {
+        if (off > size || n > size - off) {
+            throw std::system_error(EINVAL, std::generic_category(), "write_at past the end");
+        }
+        std::memcpy(buf_ + off, data, n);
+    }
+    size_t size = 0;
+
+private:
+    uint8_t* buf_;
+    size_t cap_;
+};
+
+#ifdef CLEANMETA_HAVE_URING
+
+// The process umask, read once without changing it; all bits set
+// when it can't be read, so every temp file gets an explicit chmod
+static mode_t process_umask() {
+    static const mode_t mask = [] {
+        std::ifstream in("/proc/self/status");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 6, "Umask:") == 0) return static_cast<mode_t>(std::strtoul(line.c_str() + 6, nullptr, 8));
+        }
+        return static_cast<mode_t>(07777);
+    }();
+    return mask;
+}
+
+class UringBatch {
+public:
+    // False when this kernel can't run the batch (no ring, or one of
+    // the operations missing)
+    bool init() {
+        if (!ring_.init(kUringEntries)) return false;
+        for (unsigned op : {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+            if (!ring_.supports(op)) return false;
+        }
+        can_rename_ = ring_.supports(IORING_OP_RENAMEAT);
+        buffers_.reset(static_cast<uint8_t*>(std::aligned_alloc(4096, kUringBufferBytes)));
+        if (!buffers_) return false;
+        std::vector<struct iovec> iov(kUringSlots * 2);
+        for (size_t i = 0; i < iov.size(); i++) iov[i] = {buffers_.get() + i * kUringSlotSize, kUringSlotSize};
+        fixed_ = ring_.supports(IORING_OP_READ_FIXED) && ring_.supports(IORING_OP_WRITE_FIXED) &&
+                 ring_.register_buffers(iov.data(), static_cast<unsigned>(iov.size()));
+        for (size_t i = 0; i < kUringSlots; i++) slots_[i].index = i;
+        return true;
+    }
+
+    // Cleans what the slots can take; returns the indexes of the
+    // items left for clean_file
+    std::vector<size_t> run(std::vector<BatchItem>& items, const CleanOptions& opt) {
+        rest_.clear();
+        if (broken_) {
+            for (size_t i = 0; i < items.size(); i++) rest_.push_back(i);
+            return rest_;
+        }
+        TraceSpan span("uring.batch");
+        opt_ = &opt;
+        items_ = &items;
+        size_t next = 0, active = 0;
+        std::vector<Slot*> idle;
+        for (size_t i = kUringSlots; i > 0; i--) idle.push_back(&slots_[i - 1]);
+        while (next < items.size() || active > 0) {
+            while (!idle.empty() && next < items.size()) {
+                if (!start(*idle.back(), next++)) continue;
+                idle.pop_back();
+                active++;
+            }
+            int rc = ring_.submit(1);
+            if (rc < 0) {
+                // The ring itself failed: stop using it. What the
+                // kernel took may still be using slot buffers, paths
+                // and temp files, so those completions are waited for
+                // before the unfinished files go to clean_file. A file
+                // whose operations can't be waited for fails instead.
+                broken_ = true;
+                for (uint64_t data : ring_.unqueue()) slots_[data >> 8].pending--;
+                drain();
+                for (auto& s : slots_) {
+                    if (s.item == kNone) continue;
+                    if (s.pending == 0) {
+                        abandon(s);
+                        continue;
+                    }
+                    s.err = -rc;
+                    s.what = "io_uring";
+                    fail(s);
+                }
+                for (; next < items.size(); next++) rest_.push_back(next);
+                break;
+            }
+            uint64_t data;
+            int32_t res;
+            while (ring_.cqe(data, res)) {
+                Slot& s = slots_[data >> 8];
+                step(s, static_cast<uint8_t>(data & 0xFF), res);
+                if (s.item == kNone) {
+                    idle.push_back(&s);
+                    active--;
+                }
+            }
+        }
+        return rest_;
+    }
+
+private:
+    static constexpr size_t kNone = SIZE_MAX;
+
+    enum Op : uint8_t { op_statx, op_open_in, op_read, op_close_in, op_open_out, op_write, op_close_out, op_rename };
+
+    struct Slot {
+        size_t index = 0;
+        size_t item = kNone;
+        int pending = 0;  // operations of the current step still in flight
+        int err = 0;      // first failure of the current step
+        std::string what;
+        int in_fd = -1;
+        int out_fd = -1;
+        struct statx stx;
+        size_t got = 0;   // input bytes read
+        size_t put = 0;   // output bytes written
+        size_t out_size = 0;
+        fs::path target;
+        fs::path tmp;
+        bool tmp_made = false;
+        std::chrono::steady_clock::time_point t0;
+    };
+
+    uint8_t* in_buf(const Slot& s) const { return buffers_.get() + (2 * s.index) * kUringSlotSize; }
+    uint8_t* out_buf(const Slot& s) const { return buffers_.get() + (2 * s.index + 1) * kUringSlotSize; }
+    BatchItem& item(const Slot& s) const { return (*items_)[s.item]; }
+
+    struct io_uring_sqe* queue(Slot& s, Op op, uint8_t opcode, int fd) {
+        struct io_uring_sqe* e = ring_.sqe();  // never null: two entries per slot at most
+        e->opcode = opcode;
+        e->fd = fd;
+        e->user_data = (uint64_t(s.index) << 8) | op;
+        s.pending++;
+        return e;
+    }
+
+    // False when another slot is writing the same target (an input
+    // named twice); that file waits for clean_file instead
+    bool start(Slot& s, size_t i) {
+        BatchItem& it = (*items_)[i];
+        s.target = opt_->in_place ? it.in : it.out;
+        if (!busy_.insert(s.target.native()).second) {
+            rest_.push_back(i);
+            return false;
+        }
+        s.item = i;
+        s.err = 0;
+        s.in_fd = s.out_fd = -1;
+        s.got = s.put = s.out_size = 0;
+        s.tmp_made = false;
+        s.t0 = std::chrono::steady_clock::now();
+        it.result = CleanResult();
+        it.result.policy = keep_policy(*opt_).hash;
+        s.tmp = temp_path_for(s.target);
+
+        struct io_uring_sqe* e = queue(s, op_statx, IORING_OP_STATX, AT_FDCWD);
+        e->addr = reinterpret_cast<uint64_t>(it.in.c_str());
+        e->len = STATX_MODE | STATX_SIZE;
+        e->off = reinterpret_cast<uint64_t>(&s.stx);
+        e = queue(s, op_open_in, IORING_OP_OPENAT, AT_FDCWD);
+        e->addr = reinterpret_cast<uint64_t>(it.in.c_str());
+        e->open_flags = O_RDONLY | O_CLOEXEC;
+        return true;
+    }
+
+    void queue_read(Slot& s) {
+        struct io_uring_sqe* e = queue(s, op_read, fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ, s.in_fd);
+        e->addr = reinterpret_cast<uint64_t>(in_buf(s) + s.got);
+        e->len = static_cast<uint32_t>(s.stx.stx_size - s.got);
+        e->off = s.got;
+        e->buf_index = static_cast<uint16_t>(2 * s.index);
+    }
+
+    void queue_write(Slot& s) {
+        struct io_uring_sqe* e = queue(s, op_write, fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, s.out_fd);
+        e->addr = reinterpret_cast<uint64_t>(out_buf(s) + s.put);
+        e->len = static_cast<uint32_t>(s.out_size - s.put);
+        e->off = s.put;
+        e->buf_index = static_cast<uint16_t>(2 * s.index + 1);
+    }
+
+    // Reaps every completion still due, or as many as the ring can
+    // wait for
+    void drain() {
+        while (ring_.in_flight() > 0) {
+            uint64_t data;
+            int32_t res;
+            while (ring_.cqe(data, res)) {
+                Slot& s = slots_[data >> 8];
+                s.pending--;
+                note(s, static_cast<uint8_t>(data & 0xFF), res);
+            }
+            if (ring_.in_flight() > 0 && ring_.wait() < 0) return;
+        }
+    }
+
+    // Records the fds and temp file a completed operation leaves
+    // behind, so release() can undo them
+    void note(Slot& s, uint8_t op, int32_t res) {
+        if (res < 0) return;
+        if (op == op_open_in) s.in_fd = res;
+        if (op == op_open_out) {
+            s.out_fd = res;
+            s.tmp_made = true;
+        }
+        if (op == op_close_out) s.out_fd = -1;
+        if (op == op_rename) s.tmp_made = false;
+    }
+
+    void step(Slot& s, uint8_t op, int32_t res) {
+        s.pending--;
+        BatchItem& it = item(s);
+        if (res < 0 && s.err == 0) {
+            s.err = -res;
+            switch (op) {
+                case op_statx: case op_open_in: s.what = "open " + it.in.string(); break;
+                case op_read: s.what = "read " + it.in.string(); break;
+                case op_open_out: s.what = "create " + s.tmp.string(); break;
+                case op_write: s.what = "write"; break;
+                case op_close_out: s.what = "close"; break;
+                case op_rename: s.what = "rename " + s.tmp.string(); break;
+                default: s.err = 0; break;  // closing the input can't lose data
+            }
+        }
+        note(s, op, res);
+        if (op == op_read && res > 0) s.got += static_cast<size_t>(res);
+        if (op == op_write && res > 0) s.put += static_cast<size_t>(res);
+        if (s.pending > 0) return;
+        if (s.err) return fail(s);
+
+        switch (op) {
+            case op_statx: case op_open_in:
+                if (s.stx.stx_size == 0 || s.stx.stx_size > kUringSlotSize) return abandon(s);
+                return queue_read(s);
+            case op_read:
+                if (res > 0 && s.got < s.stx.stx_size) return queue_read(s);
+                return strip(s);
+            case op_close_in: case op_open_out:
+                // The strip queued both; both are done now
+                if (s.out_fd < 0) return fail(s);
+                if ((s.stx.stx_mode & 07777 & process_umask()) && ::fchmod(s.out_fd, s.stx.stx_mode & 07777) != 0) {
+                    s.err = errno;
+                    s.what = "chmod " + s.tmp.string();
+                    return fail(s);
+                }
+                return queue_write(s);
+            case op_write:
+                if (res > 0 && s.put < s.out_size) return queue_write(s);
+                if (s.put < s.out_size) {
+                    s.err = EIO;
+                    s.what = "write";
+                    return fail(s);
+                }
+                return commit(s);
+            case op_close_out: case op_rename:
+                if (!can_rename_) {
+                    std::error_code ec;
+                    fs::rename(s.tmp, s.target, ec);
+                    if (ec) {
+                        s.err = ec.value();
+                        s.what = "rename " + s.tmp.string();
+                        return fail(s);
+                    }
+                    s.tmp_made = false;
+                }
+                return finish(s);
+        }
+    }
+
+    // Input is in memory: clean it into the output buffer, then
+    // close the input and create the temp file in one round trip
+    void strip(Slot& s) {
+        BatchItem& it = item(s);
+        CleanResult& res = it.result;
+        size_t size = s.got;
+        res.bytes_in = size;
+        const uint8_t* data = in_buf(s);
+        const FormatHandler* fmt = sniff_format(data, std::min(size, kSniffBytes), format_from_extension(it.in));
+        const KeepPolicy& keep = keep_policy(*opt_);
+        if (fmt) {
+            res.format = fmt->name;
+            trace_set_format(fmt->name);
+        }
+        if (!fmt || fmt->kind == FormatKind::pdf || !native_strip(*fmt, keep) || opt_->scrub) return abandon(s);
+
+        SlotSink sink(out_buf(s), kUringSlotSize);
+        StripStats st;
+        try {
+            TraceSpan span("strip");
+            InFile in;
+            in.open(data, size);
+            OutFile out;
+            out.open(sink);
+            if (!fmt->strip(in, out, keep, st)) return abandon(s);
+            out.close();
+            if (opt_->in_place && opt_->backup) make_backup(it.in, true);
+        } catch (const std::exception&) {
+            return abandon(s);
+        }
+        res.method = CleanMethod::native;
+        res.segments_removed = st.segments_removed;
+        res.bytes_removed = st.bytes_removed;
+        s.out_size = sink.size;
+
+        queue(s, op_close_in, IORING_OP_CLOSE, s.in_fd);
+        s.in_fd = -1;
+        struct io_uring_sqe* e = queue(s, op_open_out, IORING_OP_OPENAT, AT_FDCWD);
+        e->addr = reinterpret_cast<uint64_t>(s.tmp.c_str());
+        e->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        e->len = s.stx.stx_mode & 07777;
+    }
+
+    // Closes the temp file and, where the kernel can, renames it
+    // over the target in the same submission
+    void commit(Slot& s) {
+        struct io_uring_sqe* e = queue(s, op_close_out, IORING_OP_CLOSE, s.out_fd);
+        if (!can_rename_) return;
+        e->flags |= IOSQE_IO_LINK;
+        e = queue(s, op_rename, IORING_OP_RENAMEAT, AT_FDCWD);
+        e->addr = reinterpret_cast<uint64_t>(s.tmp.c_str());
+        e->len = static_cast<uint32_t>(AT_FDCWD);
+        e->off = reinterpret_cast<uint64_t>(s.target.c_str());
+    }
+
+    void finish(Slot& s) {
+        CleanResult& res = item(s).result;
+        res.bytes_out = s.out_size;
+        res.ok = true;
+        res.elapsed_ns = elapsed_since(s.t0);
+        done(s);
+    }
+
+    void done(Slot& s) {
+        busy_.erase(s.target.native());
+        s.item = kNone;
+    }
+
+    void release(Slot& s) {
+        if (s.in_fd >= 0) ::close(s.in_fd);
+        if (s.out_fd >= 0) ::close(s.out_fd);
+        s.in_fd = s.out_fd = -1;
+        if (s.tmp_made) {
+            std::error_code ec;
+            fs::remove(s.tmp, ec);
+        }
+        s.tmp_made = false;
+    }
+
+    void fail(Slot& s) {
+        release(s);
+        CleanResult& res = item(s).result;
+        res.ok = false;
+        res.error = std::system_error(s.err, std::generic_category(), s.what).what();
+        res.elapsed_ns = elapsed_since(s.t0);
+        done(s);
+    }
+
+    // Leaves the file to clean_file
+    void abandon(Slot& s) {
+        release(s);
+        rest_.push_back(s.item);
+        done(s);
+    }
+
+    struct FreeDeleter {
+        void operator()(uint8_t* p) const { std::free(p); }
+    };
+
+    Uring ring_;
+    std::unique_ptr<uint8_t, FreeDeleter> buffers_;
+    bool fixed_ = false;
+    bool can_rename_ = false;
+    bool broken_ = false;
+    Slot slots_[kUringSlots];
+    const CleanOptions* opt_ = nullptr;
+    std::vector<BatchItem>* items_ = nullptr;
+    std::vector<size_t> rest_;
+    std::unordered_set<std::string> busy_;  // targets of the files in flight
+};
+
+// This thread's batch engine; null when the kernel can't run one,
+// which is remembered for every thread after the first try, or
+// while --max-mem has no room for its buffers. Those stay charged
+// for the life of the thread.
+
+static UringBatch* thread_batch() {
+    static std::atomic<bool> unavailable{false};
+    struct Owned {
+        std::unique_ptr<UringBatch> batch;
+        ~Owned() {
+            if (batch) memory_budget().unpin(kUringBufferBytes);
+        }
+    };
+    thread_local Owned owned;
+    thread_local bool tried = false;
+    if (!tried && !unavailable.load(std::memory_order_relaxed)) {
+        if (!memory_budget().try_pin(kUringBufferBytes)) return nullptr;
+        tried = true;
+        auto b = std::make_unique<UringBatch>();
+        if (b->init()) {
+            owned.batch = std::move(b);
+        } else {
+            memory_budget().unpin(kUringBufferBytes);
+            unavailable.store(true, std::memory_order_relaxed);
+        }
+    }
+    return owned.batch.get();
+}
+
+#endif  // CLEANMETA_HAVE_URING
+
+IoEngine clean_files(std::vector<BatchItem>& items, const CleanOptions& opt, IoEngine engine) {
+    std::vector<size_t> rest;
+    IoEngine used = IoEngine::sync;
+#ifdef CLEANMETA_HAVE_URING
+    UringBatch* batch = engine == IoEngine::uring ? thread_batch() : nullptr;
+    if (batch) {
+        rest = batch->run(items, opt);
+        used = IoEngine::uring;
+    }
+#else
+    (void)engine;
+#endif
+    if (used == IoEngine::sync) {
+        for (size_t i = 0; i < items.size(); i++) rest.push_back(i);
+    }
+    std::sort(rest.begin(), rest.end());
+    for (size_t i : rest) {
+        BatchItem& it = items[i];
+        it.result = clean_file(it.in, it.out, opt);
+    }
+    return used;
+}
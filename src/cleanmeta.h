@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// cleanmeta_core — the cleaning engine behind the CLI and the GUI
+//
+// Link the cleanmeta_core target and include this header; Exiv2
+// and qpdf stay behind it. Files are cleaned with clean_file,
+// memory with clean_buffer and open descriptors (sockets, pipes,
+// uploads) with clean_fd, so a service never has to stage a temp
+// file. Every call returns a CleanResult instead of printing, and
+// none of them throws: failures land in CleanResult::error.
+//
+// Call cleanmeta_init() once before the first clean; after that
+// the functions are safe to call from any number of threads.
+// -------------------------------------------------------------
+
+// How a cleaned PDF is written. Trade-offs (see README):
+//   linearize — slowest: renumbers the whole object graph and adds hint
+//               tables for byte-range ("fast web view") serving
+//   rewrite   — full rewrite without linearization; object streams are
+//               expanded into a classic xref table, so output is larger
+//               but readable by very old viewers
+//   preserve  — keeps object streams and the compressed xref, copies
+//               stream data without decoding: fastest, smallest output
+//   incremental — appends an update that blanks /Info and the XMP stream;
+//               writes O(metadata) bytes, but earlier revisions (and the
+//               metadata in them) stay recoverable from the file
+enum class PdfMode { linearize, rewrite, preserve, incremental };
+
+static const char* pdf_mode_name(PdfMode mode) {
+    switch (mode) {
+        case PdfMode::linearize: return "linearize";
+        case PdfMode::rewrite:   return "rewrite";
+        case PdfMode::preserve:  return "preserve";
+        case PdfMode::incremental: return "incremental";
+    }
+    return "unknown";
+}
+
+static bool parse_pdf_mode(const std::string& s, PdfMode& mode) {
+    if (s == "linearize") mode = PdfMode::linearize;
+    else if (s == "rewrite") mode = PdfMode::rewrite;
+    else if (s == "preserve") mode = PdfMode::preserve;
+    else if (s == "incremental") mode = PdfMode::incremental;
+    else return false;
+    return true;
+}
+
+// -------------------------------------------------------------
+// Retention policy (--keep)
+//
+// By default every Exif, IPTC and XMP tag goes. A KeepPolicy names
+// the ones to keep; compile_keep_policy builds it once, up front.
+// Exif tags become one bitset per IFD indexed by tag ID, so the
+// native handlers decide keep or drop per entry in O(1) as they
+// stream, without Exiv2's ExifData. IPTC and XMP keys can only be
+// honoured by Exiv2, so a policy naming any of them sends images
+// through it. ICC profiles (JPEG APP2, PNG iCCP, WebP ICCP) are
+// never removed.
+// -------------------------------------------------------------
+enum class ExifIfd { image, photo, gps, interop, count };
+
+struct KeepPolicy {
+    std::bitset<65536> exif[static_cast<size_t>(ExifIfd::count)];  // by tag ID
+    std::vector<std::string> keys;     // Iptc.* and Xmp.* keys, sorted
+    std::vector<std::string> entries;  // canonical form, sorted; what `hash` covers
+    uint64_t hash = 0;                 // 0 for the empty policy
+    bool keeps_exif = false;
+
+    bool keeps(ExifIfd ifd, uint16_t tag) const { return exif[static_cast<size_t>(ifd)][tag]; }
+    bool keeps_key(const std::string& key) const {
+        return std::binary_search(keys.begin(), keys.end(), key);
+    }
+    bool empty() const { return entries.empty(); }
+};
+
+// Compiles policy entries: the aliases orientation, icc (the colour
+// space tags) and copyright; Exif keys by name or ID
+// (Exif.Image.Orientation, Exif.Photo.0xa001) from the Image,
+// Photo, GPSInfo and Iop groups; and Iptc.* and Xmp.* keys. Returns
+// false with `error` naming the first entry it can't use.
+bool compile_keep_policy(const std::vector<std::string>& entries, KeepPolicy& out, std::string& error);
+
+// Appends the entries of a policy file: separated by commas or
+// newlines, with # starting a comment
+bool read_keep_file(const fs::path& p, std::vector<std::string>& entries, std::string& error);
+
+struct CleanOptions {
+    bool in_place = false;  // clean_file: replace the input
+    bool scrub = false;     // with in_place: blank metadata where it lies, same file length
+    bool backup = true;     // with in_place: keep the original as <file>.bak
+    PdfMode pdf_mode = PdfMode::linearize;
+    bool pdf_squash = false;  // incremental falls back to a full rewrite
+    std::shared_ptr<const KeepPolicy> keep;  // tags to keep; null keeps none
+};
+
+// Which engine cleaned the file
+enum class CleanMethod { none, native, scrub, exiv2, qpdf };
+
+static const char* clean_method_name(CleanMethod m) {
+    switch (m) {
+        case CleanMethod::none:   return "none";
+        case CleanMethod::native: return "native";
+        case CleanMethod::scrub:  return "scrub";
+        case CleanMethod::exiv2:  return "exiv2";
+        case CleanMethod::qpdf:   return "qpdf";
+    }
+    return "unknown";
+}
+
+struct CleanResult {
+    bool ok = false;
+    const char* format = nullptr;  // "jpeg", "png", ..., "pdf"; null when unrecognised
+    CleanMethod method = CleanMethod::none;
+    PdfMode pdf_mode = PdfMode::linearize;  // mode actually used, for PDFs
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    size_t segments_removed = 0;  // native handlers and scrub
+    uint64_t bytes_removed = 0;   // native handlers; bytes zeroed for scrub
+    size_t tags_removed = 0;      // Exiv2
+    uint64_t elapsed_ns = 0;
+    uint64_t policy = 0;  // KeepPolicy::hash the file was cleaned under
+    std::string note;   // something the caller should pass on, e.g. why scrub fell back
+    std::string error;  // set when !ok; kUnsupportedFormat when no handler matched
+};
+
+static const char* const kUnsupportedFormat = "unsupported format";
+
+// -------------------------------------------------------------
+// Output sinks
+//
+// clean_buffer and clean_fd write the cleaned bytes through a
+// ByteSink in order, in chunks of up to 256 KiB. write_at rewrites
+// bytes already written (WebP patches its RIFF size at the end);
+// sinks that can't seek leave it throwing, and output of the
+// formats that need it is then staged in memory instead.
+// -------------------------------------------------------------
+class ByteSink {
+public:
+    virtual ~ByteSink() = default;
+    virtual void write(const void* data, size_t n) = 0;
+    virtual bool seekable() const { return false; }
+    virtual void write_at(uint64_t off, const void* data, size_t n);
+};
+
+class VectorSink : public ByteSink {
+public:
+    explicit VectorSink(std::vector<uint8_t>& out) : out_(out) {}
+    void write(const void* data, size_t n) override;
+    bool seekable() const override { return true; }
+    void write_at(uint64_t off, const void* data, size_t n) override;
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+// Writes to a descriptor the caller owns; seekable when it is a
+// regular file, in which case writing starts at its current offset
+class FdSink : public ByteSink {
+public:
+    explicit FdSink(int fd);
+    void write(const void* data, size_t n) override;
+    bool seekable() const override { return base_ >= 0; }
+    void write_at(uint64_t off, const void* data, size_t n) override;
+
+private:
+    int fd_;
+    int64_t base_ = -1;  // file offset of the first byte written
+};
+
+// -------------------------------------------------------------
+// Cleaning
+// -------------------------------------------------------------
+
+// Initialises Exiv2's XMP toolkit, which is not thread-safe to set
+// up lazily; call once before any worker starts
+void cleanmeta_init();
+
+// Cleans `size` bytes at `data` into `sink`. The input is sniffed
+// from its magic bytes. `opt.in_place`, `scrub` and `backup` don't
+// apply.
+CleanResult clean_buffer(const void* data, size_t size, ByteSink& sink, const CleanOptions& opt = {});
+
+// Cleans the contents of `fd` (a file, pipe or socket the caller
+// owns) into `sink`. Regular files are mapped whole rather than
+// copied. From a pipe or socket, JPEG, PNG and GIF (and WebP into
+// a seekable sink) stream through as they arrive; other formats
+// are read to EOF first.
+CleanResult clean_fd(int fd, ByteSink& sink, const CleanOptions& opt = {});
+
+// Cleans the file `in` into `out`, or into `in` itself with
+// `opt.in_place`, through a temp file renamed into place
+CleanResult clean_file(const fs::path& in, const fs::path& out, const CleanOptions& opt);
+
+// How clean_files moves bytes. uring (Linux 5.6+) keeps the opens,
+// reads, writes and renames of up to 64 files of up to 128 KiB each
+// in flight on one io_uring per thread.
+enum class IoEngine { sync, uring };
+
+static const char* io_engine_name(IoEngine e) {
+    return e == IoEngine::uring ? "uring" : "sync";
+}
+
+static bool parse_io_engine(const std::string& s, IoEngine& e) {
+    if (s == "sync") e = IoEngine::sync;
+    else if (s == "uring") e = IoEngine::uring;
+    else return false;
+    return true;
+}
+
+struct BatchItem {
+    fs::path in;
+    fs::path out;        // unused with opt.in_place
+    CleanResult result;  // filled in by clean_files
+};
+
+// Cleans each item as clean_file would. With IoEngine::uring,
+// inputs of up to 128 KiB that a native handler cleans go through
+// io_uring, up to 64 at a time; larger ones, PDFs, Exiv2 fallbacks
+// and in-place scrubs go through clean_file after them, as does
+// everything when the kernel has no io_uring. Returns the engine that did the I/O.
+IoEngine clean_files(std::vector<BatchItem>& items, const CleanOptions& opt, IoEngine engine = IoEngine::sync);
+
+// `in` with ".clean" before the extension, or `in`'s name under
+// out_dir (created if needed) when that is set
+fs::path default_output(const fs::path& in, const fs::path& out_dir);
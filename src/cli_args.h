@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// -------------------------------------------------------------
+// Command-line helpers shared by cleanmeta and cleanmeta-bench.
+// Both throw std::invalid_argument; main() turns that into a
+// message and exit code 1.
+// -------------------------------------------------------------
+
+// The value after the option at argv[i]
+static const char* next_arg(int argc, char** argv, int& i) {
+    if (i + 1 >= argc) throw std::invalid_argument(std::string(argv[i]) + " needs a value");
+    return argv[++i];
+}
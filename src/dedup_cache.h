@@ -0,0 +1,342 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <qpdf/Pl_SHA2.hh>
+
+#include "file_io.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Content-hash dedup cache (--dedup DIR)
+//
+// Before a file is cleaned, its bytes are hashed in one streaming
+// read. By default the hash is XXH64 plus the length. With
+// --dedup-hash sha256 it is SHA-256, via qpdf's Pl_SHA2, for inputs
+// that someone might craft to collide. The digest and the policy
+// hash key a cleaned copy kept under DIR/objects. A repeat is
+// satisfied with a reflink of that copy, or a plain copy where
+// reflinks are unsupported, and never touches the handlers. Results
+// aren't hard-linked: the output would share an inode with the
+// cache, and an in-place edit or a stamp xattr on it would corrupt
+// the entry.
+//
+// DIR/index lists the entries from least to most recently used
+// and is rewritten (temp + rename) when the run ends. Inserting
+// past --dedup-max evicts from the cold end. Its header names the
+// cleanmeta version that wrote it; another version starts the cache
+// over, so copies cleaned by an older handler are never served. A
+// new cache writes its index at once, and a non-empty DIR without
+// one is refused rather than emptied.
+// -------------------------------------------------------------
+enum class DedupHash { xxh64, sha256 };
+
+static const char* const kDedupIndexName = "index";
+static const char* const kDedupIndexHeader = "cleanmeta-dedup 1 " CLEANMETA_VERSION;
+static const uint64_t kDedupDefaultMax = 1ull << 30;
+
+// XXH64, streaming (https://github.com/Cyan4973/xxHash, spec v0.1.1)
+class Xxh64 {
+public:
+    Xxh64() {
+        v_[0] = kP1 + kP2;
+        v_[1] = kP2;
+        v_[2] = 0;
+        v_[3] = 0 - kP1;
+    }
+
+    void update(const uint8_t* p, size_t n) {
+        total_ += n;
+        if (fill_ + n < 32) {
+            std::memcpy(buf_ + fill_, p, n);
+            fill_ += n;
+            return;
+        }
+        if (fill_) {
+            size_t k = 32 - fill_;
+            std::memcpy(buf_ + fill_, p, k);
+            stripe(buf_);
+            p += k;
+            n -= k;
+            fill_ = 0;
+        }
+        for (; n >= 32; p += 32, n -= 32) stripe(p);
+        std::memcpy(buf_, p, n);
+        fill_ = n;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (uint64_t v : v_) h = (h ^ round(0, v)) * kP1 + kP4;
+        } else {
+            h = kP5;
+        }
+        h += total_;
+        const uint8_t* p = buf_;
+        size_t n = fill_;
+        for (; n >= 8; p += 8, n -= 8) h = rotl(h ^ round(0, le64(p)), 27) * kP1 + kP4;
+        if (n >= 4) {
+            h = rotl(h ^ (uint64_t(le32(p)) * kP1), 23) * kP2 + kP3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n > 0; p++, n--) h = rotl(h ^ (*p * kP5), 11) * kP1;
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    uint64_t total() const { return total_; }
+
+private:
+    static constexpr uint64_t kP1 = 11400714785074694791ull;
+    static constexpr uint64_t kP2 = 14029467366897019727ull;
+    static constexpr uint64_t kP3 = 1609587929392839161ull;
+    static constexpr uint64_t kP4 = 9650029242287828579ull;
+    static constexpr uint64_t kP5 = 2870177450012600261ull;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t in) { return rotl(acc + in * kP2, 31) * kP1; }
+    static uint32_t le32(const uint8_t* p) {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+    static uint64_t le64(const uint8_t* p) { return le32(p) | (uint64_t(le32(p + 4)) << 32); }
+
+    void stripe(const uint8_t* p) {
+        for (int i = 0; i < 4; i++) v_[i] = round(v_[i], le64(p + 8 * i));
+    }
+
+    uint64_t v_[4];
+    uint8_t buf_[32];
+    size_t fill_ = 0;
+    uint64_t total_ = 0;
+};
+
+// Hex digest of the contents of `p`; I/O errors throw std::system_error
+static std::string content_digest(const fs::path& p, DedupHash algo) {
+    TraceSpan span("dedup.hash");
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    std::vector<uint8_t> buf(kIoBufferSize);
+    Xxh64 xxh;
+    std::unique_ptr<Pl_SHA2> sha;
+    if (algo == DedupHash::sha256) sha = std::make_unique<Pl_SHA2>(256);
+    for (;;) {
+        ssize_t k = ::read(fd, buf.data(), buf.size());
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "read " + p.string());
+        }
+        if (k == 0) break;
+        if (sha) sha->write(buf.data(), static_cast<size_t>(k));
+        else xxh.update(buf.data(), static_cast<size_t>(k));
+    }
+    ::close(fd);
+    if (sha) {
+        sha->finish();
+        return sha->getHexDigest();
+    }
+    char hex[40];
+    std::snprintf(hex, sizeof hex, "%016llx%llx", static_cast<unsigned long long>(xxh.digest()),
+                  static_cast<unsigned long long>(xxh.total()));
+    return hex;
+}
+
+class DedupCache {
+public:
+    // Loads DIR/index; entries whose object is gone are dropped as
+    // they are looked up. Throws std::runtime_error when DIR holds
+    // something other than a cleanmeta cache.
+    void open(const fs::path& dir, uint64_t max_bytes, DedupHash algo) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fs::path path = fs::absolute(dir).lexically_normal();
+        if (path.filename().empty()) path = path.parent_path();  // "cache/"
+        std::ifstream in(path / kDedupIndexName);
+        std::string line;
+        bool have_index = static_cast<bool>(std::getline(in, line));
+        if (have_index && line.rfind("cleanmeta-dedup ", 0) != 0) {
+            throw std::runtime_error(path.string() + " has an index that is not cleanmeta's");
+        }
+        if (!have_index && fs::exists(path) && !fs::is_empty(path)) {
+            throw std::runtime_error(path.string() + " is not empty and is not a cleanmeta cache");
+        }
+        dir_ = path;
+        max_ = max_bytes;
+        algo_ = algo;
+        if (line != kDedupIndexHeader) {
+            // New, or written by another version
+            fs::remove_all(dir_ / "objects");
+            fs::create_directories(dir_ / "objects");
+            dirty_ = true;
+            save_locked();
+            return;
+        }
+        fs::create_directories(dir_ / "objects");
+        while (std::getline(in, line)) {
+            size_t t1 = line.find('\t'), t2 = line.find('\t', t1 + 1);
+            if (t2 == std::string::npos) continue;
+            add({line.substr(0, t1), line.substr(t1 + 1, t2 - t1 - 1), std::strtoull(line.c_str() + t2 + 1, nullptr, 10)});
+        }
+        evict();  // --dedup-max may be lower than last time
+    }
+
+    bool enabled() const { return !dir_.empty(); }
+    const fs::path& dir() const { return dir_; }  // absolute; empty when disabled
+    DedupHash algo() const { return algo_; }
+
+    static std::string key(const std::string& digest, uint64_t policy) {
+        char hex[24];
+        std::snprintf(hex, sizeof hex, "-%016llx", static_cast<unsigned long long>(policy));
+        return digest + hex;
+    }
+
+    // The cleaned copy for `key`, marked most recently used; false
+    // when there is none. The caller counts hits and misses, since
+    // a hit only counts once the copy has reached the output.
+    bool lookup(const std::string& key, fs::path& object, std::string& format) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find(key);
+        if (it == map_.end() || !fs::exists(object_path(key))) {
+            if (it != map_.end()) erase(it->second);
+            return false;
+        }
+        lru_.splice(lru_.end(), lru_, it->second);
+        object = object_path(key);
+        format = it->second->format;
+        dirty_ = true;
+        return true;
+    }
+
+    // Stores a copy of `cleaned` under `key`, then evicts down to the
+    // size limit. Workers cleaning the same content race here; the
+    // first claims the key and the others return.
+    void insert(const std::string& key, const fs::path& cleaned, const std::string& format) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (map_.count(key) || !storing_.insert(key).second) return;
+        }
+        TraceSpan span("dedup.store");
+        fs::path obj = object_path(key);
+        uint64_t size;
+        try {
+            fs::create_directories(obj.parent_path());
+            fs::path tmp = temp_path_for(obj);
+            copy_file_fast(cleaned, tmp);
+            fs::rename(tmp, obj);
+            size = fs::file_size(obj);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            storing_.erase(key);
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        storing_.erase(key);
+        add({key, format, size});
+        dirty_ = true;
+        evict();
+    }
+
+    void save() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        save_locked();
+    }
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> evictions{0};
+
+private:
+    void save_locked() {
+        if (!dirty_) return;
+        fs::path idx = dir_ / kDedupIndexName;
+        fs::path tmp = idx;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << kDedupIndexHeader << '\n';
+            for (auto& e : lru_) out << e.key << '\t' << e.format << '\t' << e.size << '\n';
+        }
+        std::error_code ec;
+        fs::rename(tmp, idx, ec);
+        dirty_ = false;
+    }
+
+    struct Entry {
+        std::string key;
+        std::string format;
+        uint64_t size;
+    };
+    using Lru = std::list<Entry>;
+
+    fs::path object_path(const std::string& key) const { return dir_ / "objects" / key.substr(0, 2) / key; }
+
+    void add(Entry e) {
+        if (e.key.size() < 3 || map_.count(e.key)) return;
+        bytes_ += e.size;
+        lru_.push_back(std::move(e));
+        map_[lru_.back().key] = std::prev(lru_.end());
+    }
+
+    // Drops the coldest entries until the cache fits, always keeping
+    // the newest one
+    void evict() {
+        while (bytes_ > max_ && lru_.size() > 1) {
+            std::error_code ec;
+            fs::remove(object_path(lru_.front().key), ec);
+            erase(lru_.begin());
+            evictions++;
+        }
+    }
+
+    void erase(Lru::iterator it) {
+        bytes_ -= it->size;
+        map_.erase(it->key);
+        lru_.erase(it);
+        dirty_ = true;
+    }
+
+    std::mutex mutex_;
+    fs::path dir_;
+    uint64_t max_ = kDedupDefaultMax;
+    DedupHash algo_ = DedupHash::xxh64;
+    Lru lru_;  // least recently used first
+    std::unordered_map<std::string, Lru::iterator> map_;
+    std::unordered_set<std::string> storing_;  // keys being copied in by insert()
+    uint64_t bytes_ = 0;
+    bool dirty_ = false;
+};
+
+static DedupCache& dedup_cache() {
+    static DedupCache cache;
+    return cache;
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Bounded MPMC queue
+//
+// push() blocks while the queue is full, which is what throttles
+// the scanner to the speed of the cleaners. close() wakes everyone:
+// pushes fail from then on and pop() drains what is left.
+// -------------------------------------------------------------
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        out = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Producers are done; consumers still drain the remaining items
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+    // Consumers are done too; pending items are dropped
+    void abort() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            items_.clear();
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+// -------------------------------------------------------------
+// Parallel directory scanner
+//
+// A few threads share a stack of directories still to list. Entry
+// types come from readdir's d_type (filled in from getdents), so a
+// plain file or directory costs no stat at all; only symlinks and
+// filesystems that report DT_UNKNOWN are stat'ed. Regular files,
+// including symlinks to them, stream out through next() as soon as
+// they are found; symlinked directories are not followed.
+// -------------------------------------------------------------
+struct ScanItem {
+    fs::path path;
+    size_t root = 0;  // index of the root this file was found under
+};
+
+struct ScanError {
+    fs::path path;
+    std::string message;
+};
+
+static const size_t kScanQueueCapacity = 4096;
+
+class DirScanner {
+public:
+    DirScanner(const std::vector<fs::path>& roots, size_t threads)
+        : queue_(kScanQueueCapacity) {
+        for (size_t i = 0; i < roots.size(); i++) dirs_.push_back({roots[i], i});
+        if (dirs_.empty()) {
+            queue_.close();
+            return;
+        }
+        if (threads == 0) threads = 1;
+        for (size_t i = 0; i < threads; i++) threads_.emplace_back([this] { run(); });
+    }
+
+    ~DirScanner() {
+        stop();
+        for (auto& t : threads_) t.join();
+    }
+
+    DirScanner(const DirScanner&) = delete;
+    DirScanner& operator=(const DirScanner&) = delete;
+
+    // Blocks until the next file is found; false once the scan is
+    // finished (or stopped) and every found file has been handed out
+    bool next(ScanItem& item) { return queue_.pop(item); }
+
+    // Abandons the scan, e.g. on cancel
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            dirs_.clear();
+        }
+        cv_.notify_all();
+        queue_.abort();
+    }
+
+    // Directories that could not be listed; complete once next()
+    // has returned false
+    std::vector<ScanError> errors() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return errors_;
+    }
+
+private:
+    struct Dir {
+        fs::path path;
+        size_t root;
+    };
+
+    void run() {
+        for (;;) {
+            Dir dir;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopped_ || !dirs_.empty() || active_ == 0; });
+                if (stopped_ || dirs_.empty()) return;
+                dir = std::move(dirs_.back());  // LIFO keeps the stack shallow
+                dirs_.pop_back();
+                active_++;
+            }
+            scan(dir);
+            bool done = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                active_--;
+                done = dirs_.empty() && active_ == 0;
+            }
+            if (done) {
+                queue_.close();
+                cv_.notify_all();
+            }
+        }
+    }
+
+    void scan(const Dir& dir) {
+        TraceSpan span("scan.dir");
+        DIR* d = ::opendir(dir.path.c_str());
+        if (!d) {
+            add_error(dir.path, std::strerror(errno));
+            return;
+        }
+        std::vector<Dir> subdirs;
+        for (;;) {
+            errno = 0;
+            struct dirent* e = ::readdir(d);
+            if (!e) {
+                if (errno != 0) add_error(dir.path, std::strerror(errno));
+                break;
+            }
+            const char* name = e->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+
+            fs::path p = dir.path / name;
+            unsigned char type = e->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                // lstat resolves DT_UNKNOWN; a symlink only counts when
+                // it points at a regular file
+                struct stat st {};
+                if (::lstat(p.c_str(), &st) != 0) continue;
+                if (S_ISLNK(st.st_mode)) {
+                    type = (::stat(p.c_str(), &st) == 0 && S_ISREG(st.st_mode)) ? DT_REG : DT_LNK;
+                } else {
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+                }
+            }
+            if (type == DT_DIR) {
+                subdirs.push_back({std::move(p), dir.root});
+            } else if (type == DT_REG) {
+                if (!queue_.push({std::move(p), dir.root})) break;  // stopped
+            }
+        }
+        ::closedir(d);
+
+        if (subdirs.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopped_) return;
+            for (auto& s : subdirs) dirs_.push_back(std::move(s));
+        }
+        cv_.notify_all();
+    }
+
+    void add_error(const fs::path& p, const char* message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        errors_.push_back({p, message});
+    }
+
+    BoundedQueue<ScanItem> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Dir> dirs_;
+    std::vector<ScanError> errors_;
+    std::vector<std::thread> threads_;
+    size_t active_ = 0;
+    bool stopped_ = false;
+};
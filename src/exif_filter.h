@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cleanmeta.h"
+
+// -------------------------------------------------------------
+// Exif filter for --keep
+//
+// Rebuilds the TIFF block inside a JPEG APP1 "Exif", PNG eXIf or
+// WebP EXIF chunk with only the entries the KeepPolicy keeps. The
+// filter covers IFD0 and the Exif, GPS and Interop IFDs reached
+// through it. The output keeps the input's byte order and lays each
+// IFD out followed by its out-of-line values. A pointer entry
+// survives only when its IFD keeps something. IFD1 (the thumbnail)
+// always goes.
+// -------------------------------------------------------------
+static const size_t kExifMaxEntries = 4096;
+
+class ExifFilter {
+public:
+    ExifFilter(const uint8_t* tiff, size_t n, const KeepPolicy& keep) : p_(tiff), n_(n), keep_(keep) {}
+
+    // Writes the filtered block to `out`, empty when nothing is
+    // kept; false when the block is malformed
+    bool run(std::vector<uint8_t>& out) {
+        out.clear();
+        if (n_ < 8) return false;
+        if (std::memcmp(p_, "II*\0", 4) == 0) le_ = true;
+        else if (std::memcmp(p_, "MM\0*", 4) == 0) le_ = false;
+        else return false;
+        ifds_.emplace_back();
+        if (!collect(0, ExifIfd::image, u32(4), 0)) return false;
+        if (ifds_[0].empty()) return true;
+
+        std::vector<uint32_t> at(ifds_.size());
+        uint64_t pos = 8;
+        for (size_t i = 0; i < ifds_.size(); i++) {
+            at[i] = static_cast<uint32_t>(pos);
+            pos += 2 + 12 * ifds_[i].size() + 4;
+            for (const Entry& e : ifds_[i]) {
+                if (e.size > 4) pos += e.size + (e.size & 1);
+            }
+            if (pos > 0xFFFFFFFFu) return false;
+        }
+
+        out.reserve(static_cast<size_t>(pos));
+        out.insert(out.end(), p_, p_ + 4);
+        put32(out, 8);
+        for (size_t i = 0; i < ifds_.size(); i++) {
+            uint32_t value_at = at[i] + static_cast<uint32_t>(2 + 12 * ifds_[i].size() + 4);
+            put16(out, static_cast<uint16_t>(ifds_[i].size()));
+            for (const Entry& e : ifds_[i]) {
+                put16(out, e.tag);
+                put16(out, e.type);
+                put32(out, e.count);
+                if (e.child >= 0) {
+                    put32(out, at[e.child]);
+                } else if (e.size > 4) {
+                    put32(out, value_at);
+                    value_at += e.size + (e.size & 1);
+                } else {
+                    out.insert(out.end(), p_ + e.value, p_ + e.value + 4);
+                }
+            }
+            put32(out, 0);  // no next IFD
+            for (const Entry& e : ifds_[i]) {
+                if (e.child >= 0 || e.size <= 4) continue;
+                out.insert(out.end(), p_ + e.value, p_ + e.value + e.size);
+                if (e.size & 1) out.push_back(0);
+            }
+        }
+        return true;
+    }
+
+    // Entries the policy dropped
+    size_t dropped() const { return dropped_; }
+
+private:
+    struct Entry {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        uint32_t size;   // value bytes
+        uint32_t value;  // input offset of the value, or of the inline 4 bytes
+        int child;       // index into ifds_ for a kept pointer entry, else -1
+    };
+
+    uint16_t u16(size_t off) const {
+        return le_ ? uint16_t(p_[off] | (p_[off + 1] << 8)) : uint16_t((p_[off] << 8) | p_[off + 1]);
+    }
+    uint32_t u32(size_t off) const {
+        const uint8_t* p = p_ + off;
+        return le_ ? uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24)
+                   : (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    void put16(std::vector<uint8_t>& out, uint16_t v) const {
+        uint8_t b[2];
+        if (le_) { b[0] = uint8_t(v); b[1] = uint8_t(v >> 8); }
+        else { b[0] = uint8_t(v >> 8); b[1] = uint8_t(v); }
+        out.insert(out.end(), b, b + 2);
+    }
+    void put32(std::vector<uint8_t>& out, uint32_t v) const {
+        uint8_t b[4];
+        for (int i = 0; i < 4; i++) b[le_ ? i : 3 - i] = uint8_t(v >> (8 * i));
+        out.insert(out.end(), b, b + 4);
+    }
+
+    // The IFD a pointer entry leads to, from the IFD it sits in
+    static bool child_ifd(ExifIfd in, uint16_t tag, ExifIfd& child) {
+        if (in == ExifIfd::image && tag == 0x8769) child = ExifIfd::photo;
+        else if (in == ExifIfd::image && tag == 0x8825) child = ExifIfd::gps;
+        else if (in == ExifIfd::photo && tag == 0xA005) child = ExifIfd::interop;
+        else return false;
+        return true;
+    }
+
+    // Collects the kept entries of the IFD at `off` into ifds_[slot]
+    bool collect(size_t slot, ExifIfd kind, uint32_t off, int depth) {
+        static const uint8_t kTypeSize[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4};
+        if (depth > 2 || off > n_ || n_ - off < 2) return false;
+        size_t count = u16(off);
+        if ((entries_ += count) > kExifMaxEntries || (n_ - off - 2) / 12 < count) return false;
+        std::vector<Entry> kept;
+        for (size_t i = 0; i < count; i++) {
+            size_t e = off + 2 + 12 * i;
+            uint16_t tag = u16(e);
+            ExifIfd child;
+            if (child_ifd(kind, tag, child)) {
+                size_t c = ifds_.size();
+                ifds_.emplace_back();
+                if (!collect(c, child, u32(e + 8), depth + 1)) return false;
+                if (ifds_[c].empty()) {
+                    ifds_.resize(c);  // nothing after it is referenced either
+                    continue;
+                }
+                kept.push_back({tag, u16(e + 2), u32(e + 4), 4, 0, static_cast<int>(c)});
+                continue;
+            }
+            if (!keep_.keeps(kind, tag)) {
+                dropped_++;
+                continue;
+            }
+            uint16_t type = u16(e + 2);
+            uint64_t size = uint64_t(type < sizeof kTypeSize ? kTypeSize[type] : 1) * u32(e + 4);
+            uint32_t value = static_cast<uint32_t>(e + 8);
+            if (size > 4) {
+                value = u32(e + 8);
+                if (value > n_ || size > n_ - value) return false;
+            }
+            kept.push_back({tag, type, u32(e + 4), static_cast<uint32_t>(size), value, -1});
+        }
+        std::stable_sort(kept.begin(), kept.end(), [](const Entry& a, const Entry& b) { return a.tag < b.tag; });
+        ifds_[slot] = std::move(kept);
+        return true;
+    }
+
+    const uint8_t* p_;
+    size_t n_;
+    const KeepPolicy& keep_;
+    bool le_ = true;
+    size_t entries_ = 0;
+    size_t dropped_ = 0;
+    std::vector<std::vector<Entry>> ifds_;
+};
+
+// Filters a block of `n` bytes at `tiff`; `out` is empty when none
+// of it is kept or the block is malformed
+static void filter_exif(const uint8_t* tiff, size_t n, const KeepPolicy& keep, std::vector<uint8_t>& out) {
+    ExifFilter f(tiff, n, keep);
+    if (!f.run(out)) out.clear();
+}
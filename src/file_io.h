@@ -0,0 +1,678 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "cleanmeta.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#else
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Buffered POSIX file I/O for the native format handlers
+//
+// Handlers walk the input forward once and write the output once;
+// I/O errors throw std::system_error, malformed input is reported
+// by the handler's return value. Either end can also be memory: an
+// InFile over a caller's buffer reads it in place, an OutFile over
+// a ByteSink hands it each full buffer.
+// -------------------------------------------------------------
+static const size_t kIoBufferSize = 256 * 1024;
+
+// -------------------------------------------------------------
+// Kernel-side range copies
+//
+// A handler's output is a sequence of two operations: write() new
+// bytes (rebuilt headers, patched sizes) and InFile::copy_to() an
+// input range that leaves unchanged (JPEG scan data, PNG IDAT, WebP
+// bitstream chunks, HEIF mdat). Between two files, ranges of at
+// least kRangeCopyMin go through copy_file_range, so the payload
+// never enters our buffers and filesystems that can (btrfs, XFS,
+// NFS 4.2, SMB) share extents or copy server-side. sendfile takes
+// over where copy_file_range refuses the pair of files; shorter
+// ranges, memory and ByteSink ends stay on the buffered path.
+// -------------------------------------------------------------
+static const uint64_t kRangeCopyMin = 64 * 1024;
+
+// Copies up to n bytes from in_fd's file offset to out_fd's,
+// advancing both. Returns the bytes copied: fewer than n at EOF,
+// and fewer (possibly 0) when the kernel can't copy between these
+// two files, in which case the caller copies the rest itself.
+static uint64_t kernel_copy(int in_fd, int out_fd, uint64_t n) {
+#ifdef __linux__
+    static std::atomic<bool> no_copy_file_range{false};
+    bool use_cfr = !no_copy_file_range.load(std::memory_order_relaxed);
+    uint64_t done = 0;
+    while (done < n) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(n - done, 1u << 30));
+        ssize_t k;
+        if (use_cfr) {
+            k = ::copy_file_range(in_fd, nullptr, out_fd, nullptr, chunk, 0);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                if (errno == ENOSYS) no_copy_file_range.store(true, std::memory_order_relaxed);
+                use_cfr = false;
+                continue;
+            }
+        } else {
+            k = ::sendfile(out_fd, in_fd, nullptr, chunk);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        }
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "copy range");
+        if (k == 0) break;
+        done += static_cast<uint64_t>(k);
+    }
+    return done;
+#else
+    (void)in_fd;
+    (void)out_fd;
+    (void)n;
+    return 0;
+#endif
+}
+
+class OutFile;
+
+class InFile {
+public:
+    InFile() = default;
+    ~InFile() { close(); }
+    InFile(const InFile&) = delete;
+    InFile& operator=(const InFile&) = delete;
+
+    void open(const fs::path& p) {
+        fd_ = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+        struct stat st {};
+        seekable_ = ::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+#ifdef POSIX_FADV_SEQUENTIAL
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        buf_.resize(kIoBufferSize);
+        data_ = buf_.data();
+    }
+
+    // Reads `n` bytes at `data`, which must outlive the InFile
+    void open(const void* data, size_t n) {
+        data_ = static_cast<const uint8_t*>(data);
+        len_ = n;
+        mem_size_ = n;
+    }
+
+    // Reads from a descriptor the caller keeps ownership of, such as
+    // a pipe; only the forward-reading calls work on those
+    void attach(int fd) {
+        fd_ = fd;
+        owns_fd_ = false;
+        buf_.resize(kIoBufferSize);
+        data_ = buf_.data();
+    }
+
+    void close() {
+        if (fd_ >= 0 && owns_fd_) ::close(fd_);
+        fd_ = -1;
+    }
+
+    // Before the first read: buffers up to n bytes (fewer at EOF)
+    // without consuming them, for format sniffing
+    size_t peek(const uint8_t*& p, size_t n) {
+        n = std::min(n, buf_.size());
+        while (fd_ >= 0 && len_ < n) {
+            ssize_t k = ::read(fd_, buf_.data() + len_, buf_.size() - len_);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "read");
+            if (k == 0) break;
+            len_ += static_cast<size_t>(k);
+        }
+        p = data_;
+        return std::min(n, len_);
+    }
+
+    // True while the buffer still starts at the first byte of the
+    // input, so everything read so far can be handed to another
+    // reader through buffered()
+    bool replayable() const { return offset_ == pos_; }
+
+    size_t buffered(const uint8_t*& p) const {
+        p = data_;
+        return len_;
+    }
+
+    // Bytes consumed so far
+    uint64_t offset() const { return offset_; }
+
+    // Reads exactly n bytes; false on EOF before n bytes
+    bool read(void* dst, size_t n) {
+        auto* d = static_cast<uint8_t*>(dst);
+        while (n > 0) {
+            if (pos_ == len_ && !fill()) return false;
+            size_t k = std::min(n, len_ - pos_);
+            std::memcpy(d, data_ + pos_, k);
+            pos_ += k; offset_ += k; d += k; n -= k;
+        }
+        return true;
+    }
+
+    bool read_u8(uint8_t& v) { return read(&v, 1); }
+
+    // Discards n bytes; false on EOF before n bytes. Past the buffer,
+    // a file is seeked over rather than read.
+    bool skip(uint64_t n) {
+        while (n > 0) {
+            if (pos_ == len_ && seekable_) {
+                uint64_t end = size();
+                uint64_t k = std::min(n, end > offset_ ? end - offset_ : 0);
+                seek_forward(k);
+                return k == n;
+            }
+            if (pos_ == len_ && !fill()) return false;
+            size_t k = static_cast<size_t>(std::min<uint64_t>(n, len_ - pos_));
+            pos_ += k; offset_ += k; n -= k;
+        }
+        return true;
+    }
+
+    // Discards everything up to EOF; returns the number of bytes dropped
+    uint64_t skip_all() {
+        uint64_t n = len_ - pos_;
+        offset_ += n;
+        pos_ = len_;
+        if (seekable_) {
+            uint64_t end = size();
+            uint64_t left = end > offset_ ? end - offset_ : 0;
+            seek_forward(left);
+            return n + left;
+        }
+        while (fill()) {
+            n += len_;
+            offset_ += len_;
+            pos_ = len_;
+        }
+        return n;
+    }
+
+    // Copies n bytes (or everything up to EOF with n = UINT64_MAX) to out;
+    // returns the number of bytes copied
+    uint64_t copy_to(OutFile& out, uint64_t n);
+
+    // Random access for handlers that need to look ahead (ISOBMFF);
+    // leaves the stream position alone. Returns the bytes read.
+    size_t pread(void* dst, size_t n, uint64_t off) const {
+        auto* d = static_cast<uint8_t*>(dst);
+        if (fd_ < 0) {
+            size_t k = off < mem_size_ ? static_cast<size_t>(std::min<uint64_t>(n, mem_size_ - off)) : 0;
+            std::memcpy(d, data_ + off, k);
+            return k;
+        }
+        size_t got = 0;
+        while (got < n) {
+            ssize_t k = ::pread(fd_, d + got, n - got, static_cast<off_t>(off + got));
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "pread");
+            if (k == 0) break;
+            got += static_cast<size_t>(k);
+        }
+        return got;
+    }
+
+    uint64_t size() const {
+        if (fd_ < 0) return mem_size_;
+        struct stat st {};
+        if (::fstat(fd_, &st) != 0) throw std::system_error(errno, std::generic_category(), "fstat");
+        return static_cast<uint64_t>(st.st_size);
+    }
+
+private:
+    // With the buffer drained, the descriptor's offset is offset_
+    void seek_forward(uint64_t n) {
+        if (n > 0 && ::lseek(fd_, static_cast<off_t>(n), SEEK_CUR) < 0) {
+            throw std::system_error(errno, std::generic_category(), "lseek");
+        }
+        offset_ += n;
+    }
+
+    bool fill() {
+        if (fd_ < 0) return false;  // memory: everything was there from the start
+        ssize_t k;
+        do { k = ::read(fd_, buf_.data(), buf_.size()); } while (k < 0 && errno == EINTR);
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "read");
+        pos_ = 0;
+        len_ = static_cast<size_t>(k);
+        return k > 0;
+    }
+
+    int fd_ = -1;
+    bool owns_fd_ = true;
+    bool seekable_ = false;  // a regular file opened here: ranges can be copied or skipped in the kernel
+    std::vector<uint8_t> buf_;
+    const uint8_t* data_ = nullptr;  // buf_, or the caller's memory
+    size_t mem_size_ = 0;
+    size_t pos_ = 0;
+    size_t len_ = 0;
+    uint64_t offset_ = 0;
+};
+
+class OutFile {
+public:
+    OutFile() = default;
+    ~OutFile() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    OutFile(const OutFile&) = delete;
+    OutFile& operator=(const OutFile&) = delete;
+
+    void open(const fs::path& p) {
+        fd_ = ::open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw std::system_error(errno, std::generic_category(), "create " + p.string());
+        buf_.reserve(kIoBufferSize);
+    }
+
+    void open(ByteSink& sink) {
+        sink_ = &sink;
+        buf_.reserve(kIoBufferSize);
+    }
+
+    uint64_t written() const { return written_; }
+
+    // Bytes that have left the buffer for the file or sink
+    uint64_t flushed() const { return written_ - buf_.size(); }
+
+    void write(const void* src, size_t n) {
+        const auto* s = static_cast<const uint8_t*>(src);
+        written_ += n;
+        if (buf_.size() + n > kIoBufferSize) flush();
+        if (n >= kIoBufferSize) { write_fd(s, n); return; }
+        buf_.insert(buf_.end(), s, s + n);
+    }
+
+    void write_u8(uint8_t v) { write(&v, 1); }
+
+    // Appends up to n bytes from in_fd's current offset without
+    // reading them into memory; returns the bytes copied, 0 when the
+    // output isn't a file or the kernel can't copy between the two
+    uint64_t copy_range(int in_fd, uint64_t n) {
+        if (sink_ || fd_ < 0 || no_ranges_) return 0;
+        flush();
+        uint64_t k = kernel_copy(in_fd, fd_, n);
+        if (k == 0) no_ranges_ = true;
+        written_ += k;
+        return k;
+    }
+
+    // Overwrites bytes already written, e.g. a size field that is
+    // only known at the end; `off` + n must not pass written()
+    void write_at(uint64_t off, const void* src, size_t n) {
+        flush();
+        if (sink_) {
+            sink_->write_at(off, src, n);
+            return;
+        }
+        const auto* s = static_cast<const uint8_t*>(src);
+        while (n > 0) {
+            ssize_t k = ::pwrite(fd_, s, n, static_cast<off_t>(off));
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "pwrite");
+            s += k;
+            off += static_cast<uint64_t>(k);
+            n -= static_cast<size_t>(k);
+        }
+    }
+
+    void flush() {
+        if (buf_.empty()) return;
+        write_fd(buf_.data(), buf_.size());
+        buf_.clear();
+    }
+
+    void close() {
+        flush();
+        if (fd_ >= 0 && ::close(fd_) != 0) {
+            fd_ = -1;
+            throw std::system_error(errno, std::generic_category(), "close");
+        }
+        fd_ = -1;
+    }
+
+private:
+    void write_fd(const uint8_t* s, size_t n) {
+        if (sink_) {
+            sink_->write(s, n);
+            return;
+        }
+        while (n > 0) {
+            ssize_t k = ::write(fd_, s, n);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "write");
+            s += k;
+            n -= static_cast<size_t>(k);
+        }
+    }
+
+    int fd_ = -1;
+    ByteSink* sink_ = nullptr;
+    bool no_ranges_ = false;  // the kernel refused a range copy once; don't retry per range
+    std::vector<uint8_t> buf_;
+    uint64_t written_ = 0;
+};
+
+inline uint64_t InFile::copy_to(OutFile& out, uint64_t n) {
+    uint64_t copied = 0;
+    while (n > 0) {
+        if (pos_ == len_ && seekable_ && n >= kRangeCopyMin) {
+            uint64_t k = out.copy_range(fd_, n);
+            offset_ += k; n -= k; copied += k;
+            if (n == 0) break;
+        }
+        if (pos_ == len_ && !fill()) break;
+        size_t k = static_cast<size_t>(std::min<uint64_t>(n, len_ - pos_));
+        out.write(data_ + pos_, k);
+        pos_ += k; offset_ += k; n -= k; copied += k;
+    }
+    return copied;
+}
+
+// What a native handler dropped from one file
+struct StripStats {
+    size_t segments_removed = 0;
+    uint64_t bytes_removed = 0;
+};
+
+// -------------------------------------------------------------
+// In-place scrubbing
+//
+// A scrub handler reads only the structure it needs (segment, chunk
+// or IFD headers) with pread and records its edits in a ScrubPlan;
+// nothing is written until the whole file has been walked, so a
+// handler that returns false leaves the file untouched. The plan
+// zeroes payloads first and rewrites headers last, so a crash part
+// way through leaves zeroed payloads under their old, still valid,
+// headers. The file length never changes.
+// -------------------------------------------------------------
+class PatchFile {
+public:
+    PatchFile() = default;
+    ~PatchFile() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    PatchFile(const PatchFile&) = delete;
+    PatchFile& operator=(const PatchFile&) = delete;
+
+    void open(const fs::path& p) {
+        fd_ = ::open(p.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd_ < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+        struct stat st {};
+        if (::fstat(fd_, &st) != 0) throw std::system_error(errno, std::generic_category(), "fstat");
+        size_ = static_cast<uint64_t>(st.st_size);
+    }
+
+    uint64_t size() const { return size_; }
+
+    // Reads exactly n bytes at off; false when the file ends first
+    bool read_at(uint64_t off, void* dst, size_t n) const {
+        if (off > size_ || n > size_ - off) return false;
+        auto* d = static_cast<uint8_t*>(dst);
+        while (n > 0) {
+            ssize_t k = ::pread(fd_, d, n, static_cast<off_t>(off));
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "pread");
+            if (k == 0) return false;
+            d += k;
+            off += static_cast<uint64_t>(k);
+            n -= static_cast<size_t>(k);
+        }
+        return true;
+    }
+
+    void write_at(uint64_t off, const void* src, size_t n) {
+        const auto* s = static_cast<const uint8_t*>(src);
+        while (n > 0) {
+            ssize_t k = ::pwrite(fd_, s, n, static_cast<off_t>(off));
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) throw std::system_error(errno, std::generic_category(), "pwrite");
+            s += k;
+            off += static_cast<uint64_t>(k);
+            n -= static_cast<size_t>(k);
+        }
+    }
+
+    void close() {
+        if (fd_ >= 0 && ::close(fd_) != 0) {
+            fd_ = -1;
+            throw std::system_error(errno, std::generic_category(), "close");
+        }
+        fd_ = -1;
+    }
+
+private:
+    int fd_ = -1;
+    uint64_t size_ = 0;
+};
+
+struct ScrubPlan {
+    struct Patch {
+        uint64_t off;
+        std::vector<uint8_t> bytes;
+    };
+    std::vector<std::pair<uint64_t, uint64_t>> zeros;  // offset, length
+    std::vector<Patch> patches;
+
+    void zero(uint64_t off, uint64_t n) {
+        if (n > 0) zeros.emplace_back(off, n);
+    }
+
+    void write(uint64_t off, const void* src, size_t n) {
+        const auto* s = static_cast<const uint8_t*>(src);
+        patches.push_back({off, std::vector<uint8_t>(s, s + n)});
+    }
+
+    uint64_t zeroed() const {
+        uint64_t n = 0;
+        for (auto& z : zeros) n += z.second;
+        return n;
+    }
+
+    void apply(PatchFile& f) const {
+        static const uint8_t kZeros[4096] = {};
+        for (auto& z : zeros) {
+            for (uint64_t done = 0; done < z.second;) {
+                size_t k = static_cast<size_t>(std::min<uint64_t>(sizeof kZeros, z.second - done));
+                f.write_at(z.first + done, kZeros, k);
+                done += k;
+            }
+        }
+        for (auto& p : patches) f.write_at(p.off, p.bytes.data(), p.bytes.size());
+    }
+};
+
+// Plans with `scrub(const PatchFile&, ScrubPlan&, StripStats&)` and
+// applies the plan to `p` itself; the handler counts segments, the
+// byte count is what the plan zeroes. Returns false, with the file
+// untouched, when the handler can't scrub this file.
+template <class Scrub>
+static bool scrub_file(const fs::path& p, Scrub&& scrub, StripStats& st) {
+    TraceSpan span("scrub");
+    PatchFile f;
+    f.open(p);
+    ScrubPlan plan;
+    if (!scrub(static_cast<const PatchFile&>(f), plan, st)) return false;
+    st.bytes_removed = plan.zeroed();
+    plan.apply(f);
+    f.close();
+    return true;
+}
+
+// -------------------------------------------------------------
+// Streams src through `filter(InFile&, OutFile&)` into dst.
+//
+// The output is written to a temp file next to dst and renamed
+// over it on success, so dst may be src itself (in-place) and a
+// failed or rejected run never leaves a partial file behind.
+// Returns false when the filter rejects the input.
+// -------------------------------------------------------------
+static fs::path temp_path_for(const fs::path& target) {
+    fs::path tmp = target;
+    tmp.replace_filename("." + target.filename().string() + ".cleanmeta.tmp");
+    return tmp;
+}
+
+// True for the temp files written above, so directory walks that
+// race with in-flight writes don't pick them up
+static bool is_temp_path(const fs::path& p) {
+    const std::string name = p.filename().string();
+    static const std::string suffix = ".cleanmeta.tmp";
+    return name.size() > suffix.size() && name[0] == '.' &&
+           name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The --incremental sidecar index (stamp.h)
+static const char* const kStampIndexName = ".cleanmeta-index";
+
+// True for files cleanmeta leaves in a tree itself: temp files, the
+// .bak backups of --in-place (and the .bak.bak an earlier run made by
+// cleaning one), the stamp sidecar and everything in the --dedup
+// cache. Directory walks skip them so a run never cleans its own
+// output; a file named on the command line is still cleaned.
+// `dedup_dir` is absolute and lexically normal, or empty.
+static bool is_internal_path(const fs::path& p, const fs::path& dedup_dir = {}) {
+    if (is_temp_path(p)) return true;
+    const std::string name = p.filename().string();
+    static const std::string bak = ".bak";
+    if (name == kStampIndexName) return true;
+    if (name.size() > bak.size() && name.compare(name.size() - bak.size(), bak.size(), bak) == 0) return true;
+    if (dedup_dir.empty()) return false;
+    fs::path abs = fs::absolute(p).lexically_normal();
+    return std::mismatch(dedup_dir.begin(), dedup_dir.end(), abs.begin(), abs.end()).first == dedup_dir.end();
+}
+
+template <class Filter>
+static bool filter_file(const fs::path& src, const fs::path& dst, Filter&& filter) {
+    TraceSpan span("strip");
+    fs::path tmp = temp_path_for(dst);
+    try {
+        InFile in;
+        in.open(src);
+        OutFile out;
+        out.open(tmp);
+        if (!filter(in, out)) {
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return false;
+        }
+        out.close();
+        fs::permissions(tmp, fs::status(src).permissions());
+        fs::rename(tmp, dst);
+        return true;
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+}
+
+// -------------------------------------------------------------
+// Cheap copies and backups
+//
+// reflink_file shares the source's extents (FICLONE on Linux,
+// clonefile on macOS), so the copy is a metadata operation on
+// btrfs, XFS and APFS; it returns false where that's unsupported.
+// -------------------------------------------------------------
+static bool reflink_file(const fs::path& src, const fs::path& dst) {
+    std::error_code ec;
+    fs::remove(dst, ec);
+#ifdef __APPLE__
+    return ::clonefile(src.c_str(), dst.c_str(), 0) == 0;
+#else
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+    bool ok = ::ioctl(out, FICLONE, in) == 0;
+    ::close(in);
+    ::close(out);
+    if (!ok) fs::remove(dst, ec);
+    return ok;
+#endif
+}
+
+// Reflink when possible, else a full copy; dst gets src's permissions
+static void copy_file_fast(const fs::path& src, const fs::path& dst) {
+    TraceSpan span("copy");
+    if (reflink_file(src, dst)) {
+        fs::permissions(dst, fs::status(src).permissions());
+        return;
+    }
+    {
+        InFile in;
+        in.open(src);
+        OutFile out;
+        out.open(dst);
+        if (in.copy_to(out, UINT64_MAX) != in.size()) {
+            throw std::system_error(EIO, std::generic_category(), "copy " + src.string());
+        }
+        out.close();
+    }
+    fs::permissions(dst, fs::status(src).permissions());
+}
+
+// Creates `in.bak` unless one exists. When the caller is going to
+// rename a new file over `in` (`replaced`), the backup is a hard
+// link to the original inode, which the rename leaves untouched;
+// otherwise it is a reflink, and only as a last resort a copy.
+static void make_backup(const fs::path& in, bool replaced) {
+    TraceSpan span("backup");
+    fs::path bak = in;
+    bak += ".bak";
+    if (fs::exists(bak)) return;
+    if (replaced && ::link(in.c_str(), bak.c_str()) == 0) return;
+    if (reflink_file(in, bak)) {
+        fs::permissions(bak, fs::status(in).permissions());
+        return;
+    }
+    fs::copy_file(in, bak);
+}
+
+// Copies src to a temp file beside dst, lets `edit(tmp)` modify it
+// in place and renames it over dst. For libraries that can only
+// edit a file where it lies (Exiv2). Returns false when `edit` does.
+template <class Edit>
+static bool edit_file(const fs::path& src, const fs::path& dst, Edit&& edit) {
+    fs::path tmp = temp_path_for(dst);
+    try {
+        copy_file_fast(src, tmp);
+        if (!edit(tmp)) {
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return false;
+        }
+        fs::rename(tmp, dst);
+        return true;
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+}
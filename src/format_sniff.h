@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_io.h"
+#include "gif_strip.h"
+#include "isobmff_strip.h"
+#include "jpeg_strip.h"
+#include "png_strip.h"
+#include "tiff_scrub.h"
+#include "webp_strip.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Format detection
+//
+// A file is identified by its leading bytes, read with one pread;
+// the extension only decides which signature is tried first. Each
+// entry of kFormatHandlers says how its format is cleaned: with a
+// native streaming handler, or (strip == nullptr) with Exiv2 for
+// images and qpdf for PDFs, and whether --scrub-in-place can blank
+// its metadata where it lies (scrub != nullptr).
+// -------------------------------------------------------------
+enum class FormatKind { image, pdf };
+
+using StripFn = bool (*)(InFile&, OutFile&, const KeepPolicy&, StripStats&);
+using ScrubFn = bool (*)(const PatchFile&, ScrubPlan&, StripStats&);
+using MatchFn = bool (*)(const uint8_t*, size_t);
+
+struct FormatHandler {
+    const char* name;
+    FormatKind kind;
+    const char* extensions;  // space-separated, lowercase, without the dot
+    MatchFn match;
+    StripFn strip;
+    ScrubFn scrub;
+    bool patches_output = false;  // strip rewrites earlier output (OutFile::write_at)
+    bool random_access = false;   // strip seeks in its input (InFile::pread), so can't read a pipe
+};
+
+// PDF readers accept up to 1 KiB of junk before the %PDF- header
+static const size_t kSniffBytes = 1024;
+
+static bool starts_with(const uint8_t* b, size_t n, const char* magic, size_t len) {
+    return n >= len && std::memcmp(b, magic, len) == 0;
+}
+
+static bool match_jpeg(const uint8_t* b, size_t n) {
+    return n >= 3 && b[0] == 0xFF && b[1] == 0xD8 && b[2] == 0xFF;
+}
+
+static bool match_png(const uint8_t* b, size_t n) {
+    return n >= 8 && std::memcmp(b, kPngSignature, 8) == 0;
+}
+
+static bool match_gif(const uint8_t* b, size_t n) {
+    return starts_with(b, n, "GIF87a", 6) || starts_with(b, n, "GIF89a", 6);
+}
+
+static bool match_webp(const uint8_t* b, size_t n) {
+    return n >= 12 && std::memcmp(b, "RIFF", 4) == 0 && std::memcmp(b + 8, "WEBP", 4) == 0;
+}
+
+// Classic and BigTIFF, in both byte orders; DNG and most camera raw
+// formats are TIFF underneath
+static bool match_tiff(const uint8_t* b, size_t n) {
+    return starts_with(b, n, "II*\0", 4) || starts_with(b, n, "MM\0*", 4) ||
+           starts_with(b, n, "II+\0", 4) || starts_with(b, n, "MM\0+", 4);
+}
+
+// ISOBMFF with an HEIF/AVIF brand, major or compatible
+static bool match_heif(const uint8_t* b, size_t n) {
+    static const char* const kBrands[] = {"heic", "heix", "heim", "heis", "hevc", "hevx",
+                                          "mif1", "msf1", "avif", "avis"};
+    if (n < 16 || std::memcmp(b + 4, "ftyp", 4) != 0) return false;
+    size_t size = (size_t(b[0]) << 24) | (size_t(b[1]) << 16) | (size_t(b[2]) << 8) | b[3];
+    size = std::min(size, n);
+    for (size_t at = 8; at + 4 <= size; at += 4) {
+        if (at == 12) continue;  // minor version
+        for (const char* brand : kBrands) {
+            if (std::memcmp(b + at, brand, 4) == 0) return true;
+        }
+    }
+    return false;
+}
+
+static bool match_pdf(const uint8_t* b, size_t n) {
+    return ::memmem(b, n, "%PDF-", 5) != nullptr;
+}
+
+static constexpr FormatHandler kFormatHandlers[] = {
+    {"jpeg", FormatKind::image, "jpg jpeg jpe jfif", match_jpeg, strip_jpeg,    scrub_jpeg},
+    {"png",  FormatKind::image, "png",               match_png,  strip_png,     scrub_png},
+    {"gif",  FormatKind::image, "gif",               match_gif,  strip_gif,     nullptr},
+    {"webp", FormatKind::image, "webp",              match_webp, strip_webp,    nullptr, true},
+    {"tiff", FormatKind::image, "tif tiff dng nef cr2 arw orf pef rw2 srw", match_tiff, nullptr, scrub_tiff},
+    {"heif", FormatKind::image, "heic heif hif avif", match_heif, strip_isobmff, nullptr, false, true},
+    {"pdf",  FormatKind::pdf,   "pdf",               match_pdf,  nullptr,       nullptr},
+};
+
+// Case-insensitive test of `ext` against a handler's extension list
+static bool format_has_extension(const FormatHandler& h, const char* ext, size_t len) {
+    const char* s = h.extensions;
+    while (*s) {
+        const char* end = s;
+        while (*end && *end != ' ') end++;
+        if (size_t(end - s) == len) {
+            size_t i = 0;
+            while (i < len && std::tolower(static_cast<unsigned char>(ext[i])) == s[i]) i++;
+            if (i == len) return true;
+        }
+        s = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+// The handler the extension suggests, without touching the file
+static const FormatHandler* format_from_extension(const fs::path& p) {
+    const std::string& s = p.native();
+    size_t dot = s.rfind('.');
+    if (dot == std::string::npos || s.find('/', dot) != std::string::npos) return nullptr;
+    for (const auto& h : kFormatHandlers) {
+        if (format_has_extension(h, s.data() + dot + 1, s.size() - dot - 1)) return &h;
+    }
+    return nullptr;
+}
+
+// Identifies a file from its first bytes, trying `hint` first
+static const FormatHandler* sniff_format(const uint8_t* head, size_t n, const FormatHandler* hint) {
+    if (hint && hint->match(head, n)) return hint;
+    for (const auto& h : kFormatHandlers) {
+        if (&h != hint && h.match(head, n)) return &h;
+    }
+    return nullptr;
+}
+
+// Identifies `p` from its first kSniffBytes; nullptr when no handler
+// recognises it. I/O errors throw std::system_error.
+static const FormatHandler* sniff_format(const fs::path& p) {
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+    uint8_t head[kSniffBytes];
+    ssize_t n;
+    do { n = ::pread(fd, head, sizeof head, 0); } while (n < 0 && errno == EINTR);
+    int err = errno;
+    ::close(fd);
+    if (n < 0) throw std::system_error(err, std::generic_category(), "read " + p.string());
+    return sniff_format(head, size_t(n), format_from_extension(p));
+}
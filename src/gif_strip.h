@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "file_io.h"
+
+// -------------------------------------------------------------
+// Native GIF handler
+//
+// Walks the block stream once. Image data, graphic control and
+// plain-text extensions are copied through, as are the application
+// extensions that affect rendering (NETSCAPE2.0 / ANIMEXTS1.0 loop
+// counts, the ICC profile). Comments, XMP and every other
+// application extension are dropped, as is anything after the
+// trailer. Exiv2 can read GIF but not write it, so this is the only
+// clean path for the format.
+// -------------------------------------------------------------
+static const char* const kGifKeepApps[] = {"NETSCAPE2.0", "ANIMEXTS1.0", "ICCRGBG1012"};
+
+static bool gif_keeps_app(const uint8_t id[11]) {
+    for (const char* keep : kGifKeepApps) {
+        if (std::memcmp(id, keep, 11) == 0) return true;
+    }
+    return false;
+}
+
+// Copies (out != nullptr) or skips a run of data sub-blocks up to
+// and including the zero-length terminator; adds the byte count
+static bool gif_sub_blocks(InFile& in, OutFile* out, uint64_t& bytes) {
+    for (;;) {
+        uint8_t len;
+        if (!in.read_u8(len)) return false;
+        bytes += 1 + len;
+        if (out) {
+            out->write_u8(len);
+            if (in.copy_to(*out, len) != len) return false;
+        } else if (!in.skip(len)) {
+            return false;
+        }
+        if (len == 0) return true;
+    }
+}
+
+static bool gif_color_table(InFile& in, OutFile& out, uint8_t packed) {
+    if (!(packed & 0x80)) return true;
+    uint64_t n = 3u << ((packed & 7) + 1);
+    return in.copy_to(out, n) == n;
+}
+
+// Returns false when the input is not a well-formed GIF. Exiv2 can't
+// write GIF, so the file is then reported as failed.
+static bool strip_gif(InFile& in, OutFile& out, const KeepPolicy&, StripStats& st) {
+    uint8_t hdr[13];  // signature + logical screen descriptor
+    if (!in.read(hdr, sizeof hdr)) return false;
+    if (std::memcmp(hdr, "GIF87a", 6) != 0 && std::memcmp(hdr, "GIF89a", 6) != 0) return false;
+    out.write(hdr, sizeof hdr);
+    if (!gif_color_table(in, out, hdr[10])) return false;
+
+    for (;;) {
+        uint8_t block;
+        if (!in.read_u8(block)) return false;  // missing trailer
+        if (block == 0x3B) {
+            out.write_u8(block);
+            st.bytes_removed += in.skip_all();
+            return true;
+        }
+        if (block == 0x2C) {
+            uint8_t desc[9];
+            if (!in.read(desc, sizeof desc)) return false;
+            out.write_u8(block);
+            out.write(desc, sizeof desc);
+            if (!gif_color_table(in, out, desc[8])) return false;
+            uint8_t lzw_min;
+            if (!in.read_u8(lzw_min)) return false;
+            out.write_u8(lzw_min);
+            uint64_t n = 0;
+            if (!gif_sub_blocks(in, &out, n)) return false;
+            continue;
+        }
+        if (block != 0x21) return false;
+
+        uint8_t label;
+        if (!in.read_u8(label)) return false;
+        bool keep = label == 0xF9 || label == 0x01;  // graphic control, plain text
+        uint8_t app[12];
+        bool have_app = false;
+        if (label == 0xFF) {
+            // The first sub-block holds the identifier and auth code
+            if (!in.read(app, sizeof app) || app[0] != 11) return false;
+            keep = gif_keeps_app(app + 1);
+            have_app = true;
+        }
+
+        uint64_t bytes = 2 + (have_app ? sizeof app : 0);
+        if (keep) {
+            out.write_u8(block);
+            out.write_u8(label);
+            if (have_app) out.write(app, sizeof app);
+            if (!gif_sub_blocks(in, &out, bytes)) return false;
+        } else {
+            if (!gif_sub_blocks(in, nullptr, bytes)) return false;
+            st.segments_removed++;
+            st.bytes_removed += bytes;
+        }
+    }
+}
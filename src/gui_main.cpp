@@ -7,34 +7,116 @@
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/Fl_Progress.H>
 #include <FL/Fl_Check_Button.H>
+#include <FL/Fl_Choice.H>
 #include <FL/Fl_Input.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Group.H>
 #include <FL/fl_ask.H>
 #include <FL/Fl_Scroll.H>
+#include <FL/Fl_Table.H>
+#include <FL/fl_draw.H>
 
+#include <algorithm>
 #include <thread>
-#include <chrono>
 #include <atomic>
-#include <queue>
+#include <deque>
 #include <mutex>
-#include <sstream>
+#include <string>
 
-#include "metadata_core.h"
+#include "batch_pool.h"
+#include "cleanmeta.h"
+#include "dir_scan.h"
+#include "file_io.h"
+#include "format_sniff.h"
+
+// What the batch needs from the widgets, read on the main thread
+struct Options : CleanOptions {
+    bool recursive = false;
+    fs::path out_dir;
+};
+
+// Folders are kept in the selection with a trailing separator
+static bool is_folder_entry(const std::string& entry) {
+    return !entry.empty() && entry.back() == '/';
+}
+
+// Bytes of log kept in the display; older lines are trimmed in
+// kLogTrimBytes chunks so a trim is rare and never per line
+static const int kLogMaxBytes = 1 << 20;
+static const int kLogTrimBytes = 256 * 1024;
+
+// -------------------------------------------------------------
+// Virtualized file list
+//
+// Fl_Table only asks for the cells in view, so the row text is
+// formatted on demand and a 50k-file selection costs nothing
+// until it is scrolled to.
+// -------------------------------------------------------------
+class FileListTable : public Fl_Table {
+public:
+    FileListTable(int x, int y, int w, int h, const std::vector<std::string>& files)
+        : Fl_Table(x, y, w, h), files_(files) {
+        cols(1);
+        col_resize(0);
+        row_height_all(18);
+        color(FL_DARK3);
+        end();
+    }
+
+    // Call after the underlying vector changes
+    void refresh() {
+        rows(static_cast<int>(files_.size()));
+        col_width(0, tiw);
+        row_position(0);
+        redraw();
+    }
+
+protected:
+    void draw_cell(TableContext context, int R, int /*C*/, int X, int Y, int W, int H) override {
+        if (context != CONTEXT_CELL || R >= static_cast<int>(files_.size())) return;
+        std::string text = std::to_string(R + 1) + ". ";
+        if (is_folder_entry(files_[R])) {
+            text += files_[R] + " [FOLDER]";
+        } else {
+            fs::path path(files_[R]);
+            // Extension only: the format is sniffed when the file is cleaned
+            const FormatHandler* fmt = format_from_extension(path);
+            text += path.filename().string() + " [" + (fmt ? fmt->name : "?") + "]   " +
+                    path.parent_path().string();
+        }
+
+        fl_push_clip(X, Y, W, H);
+        fl_color(FL_DARK3);
+        fl_rectf(X, Y, W, H);
+        fl_color(FL_LIGHT2);
+        fl_font(FL_HELVETICA, 12);
+        fl_draw(text.c_str(), X + 4, Y, W - 4, H, FL_ALIGN_LEFT);
+        fl_pop_clip();
+    }
+
+    void resize(int X, int Y, int W, int H) override {
+        Fl_Table::resize(X, Y, W, H);
+        col_width(0, tiw);
+    }
+
+private:
+    const std::vector<std::string>& files_;
+};
 
 // GUI Application Class
 class CleanMetaGUI {
 private:
     Fl_Window* main_window;
     Fl_Button* select_files_btn;
+    Fl_Button* add_folder_btn;
     Fl_Button* process_btn;
     Fl_Check_Button* in_place_check;
     Fl_Check_Button* backup_check;
     Fl_Check_Button* recursive_check;
+    Fl_Choice* pdf_mode_choice;
     Fl_Input* output_dir_input;
     Fl_Button* browse_output_btn;
-    Fl_Text_Display* file_list_display;
-    Fl_Text_Buffer* file_list_buffer;
+    FileListTable* file_list_table;
     Fl_Text_Display* log_display;
     Fl_Text_Buffer* log_buffer;
     Fl_Progress* progress_bar;
@@ -42,12 +124,15 @@ private:
     
     // Application state
     std::vector<std::string> selected_files;
-    std::vector<std::string> log_messages;
-    bool processing = false;
+    std::atomic<bool> processing{false};
+    std::atomic<bool> cancel_requested{false};
+    bool was_processing = false;
     std::atomic<int> progress{0};
+    std::atomic<int> successful{0};
     std::atomic<int> total_files{0};
     std::mutex log_mutex;
-    std::queue<std::string> log_queue;
+    std::deque<std::string> log_queue;
+    std::thread batch_thread;
     
 public:
     CleanMetaGUI() {
@@ -56,7 +141,8 @@ public:
     }
     
     ~CleanMetaGUI() {
-        delete file_list_buffer;
+        cancel_requested = true;
+        if (batch_thread.joinable()) batch_thread.join();
         delete log_buffer;
         delete main_window;
     }
@@ -99,17 +185,18 @@ private:
         select_files_btn->labelfont(FL_BOLD);
         select_files_btn->tooltip("Click to select multiple files to clean");
         
+        add_folder_btn = new Fl_Button(250, 110, 200, 40, "📂 Add Folder");
+        add_folder_btn->color(FL_BLUE);
+        add_folder_btn->labelcolor(FL_WHITE);
+        add_folder_btn->labelfont(FL_BOLD);
+        add_folder_btn->tooltip("Add a folder; its files are found while cleaning runs");
+        
         // File list display
         Fl_Box* files_label = new Fl_Box(40, 160, 200, 20, "Selected Files:");
         files_label->labelcolor(FL_WHITE);
         files_label->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
         
-        file_list_buffer = new Fl_Text_Buffer();
-        file_list_display = new Fl_Text_Display(40, 180, 410, 150);
-        file_list_display->buffer(file_list_buffer);
-        file_list_display->color(FL_DARK3);
-        file_list_display->textcolor(FL_LIGHT2);
-        file_list_display->wrap_mode(1, 80);
+        file_list_table = new FileListTable(40, 180, 410, 150, selected_files);
         
         // Options section
         Fl_Box* options_label = new Fl_Box(40, 340, 200, 20, "Options:");
@@ -129,6 +216,18 @@ private:
         recursive_check->labelcolor(FL_WHITE);
         recursive_check->value(0);
         
+        pdf_mode_choice = new Fl_Choice(330, 430, 120, 25, "PDF:");
+        pdf_mode_choice->labelcolor(FL_WHITE);
+        pdf_mode_choice->add("Linearize");
+        pdf_mode_choice->add("Rewrite");
+        pdf_mode_choice->add("Preserve");
+        pdf_mode_choice->add("Incremental");
+        pdf_mode_choice->value(0);
+        pdf_mode_choice->tooltip("Linearize: web-optimized, slowest\n"
+                                 "Rewrite: plain rewrite, larger output\n"
+                                 "Preserve: keeps object streams, fastest\n"
+                                 "Incremental: appends an update; old revisions remain");
+        
         // Output directory
         Fl_Box* output_label = new Fl_Box(40, 460, 200, 20, "Output Directory:");
         output_label->labelcolor(FL_WHITE);
@@ -191,6 +290,7 @@ private:
     
     void setup_callbacks() {
         select_files_btn->callback(select_files_cb, this);
+        add_folder_btn->callback(add_folder_cb, this);
         process_btn->callback(process_files_cb, this);
         browse_output_btn->callback(browse_output_cb, this);
         in_place_check->callback(in_place_cb, this);
@@ -203,6 +303,10 @@ private:
         static_cast<CleanMetaGUI*>(data)->select_files();
     }
     
+    static void add_folder_cb(Fl_Widget*, void* data) {
+        static_cast<CleanMetaGUI*>(data)->add_folder();
+    }
+    
     static void process_files_cb(Fl_Widget*, void* data) {
         static_cast<CleanMetaGUI*>(data)->process_files();
     }
@@ -247,6 +351,29 @@ private:
         }
     }
     
+    void add_folder() {
+        Fl_Native_File_Chooser chooser;
+        chooser.title("Select a folder to clean");
+        chooser.type(Fl_Native_File_Chooser::BROWSE_DIRECTORY);
+        
+        switch (chooser.show()) {
+            case 0: {
+                std::string dir = chooser.filename();
+                if (!is_folder_entry(dir)) dir += '/';
+                selected_files.push_back(dir);
+                if (!recursive_check->value()) recursive_check->value(1);
+                update_file_list();
+                update_ui_state();
+                break;
+            }
+            case 1:  // User cancelled
+                break;
+            default:  // Error
+                fl_alert("Error opening folder chooser: %s", chooser.errmsg());
+                break;
+        }
+    }
+    
     void browse_output_directory() {
         const char* dirname = fl_dir_chooser("Select output directory", nullptr);
         if (dirname) {
@@ -255,31 +382,9 @@ private:
     }
     
     void update_file_list() {
-        std::stringstream ss;
-        if (selected_files.empty()) {
-            ss << "No files selected.\nClick 'Select Files' to choose files to process.";
-        } else {
-            ss << "Selected " << selected_files.size() << " file(s):\n\n";
-            for (size_t i = 0; i < selected_files.size(); ++i) {
-                fs::path path(selected_files[i]);
-                ss << (i + 1) << ". " << path.filename().string();
-                
-                // Show file type
-                if (is_image(path)) {
-                    ss << " [IMAGE]";
-                } else if (is_pdf(path)) {
-                    ss << " [PDF]";
-                } else {
-                    ss << " [UNSUPPORTED]";
-                }
-                
-                ss << "\n";
-                
-                // Show directory on next line for better readability
-                ss << "   " << path.parent_path().string() << "\n\n";
-            }
-        }
-        file_list_buffer->text(ss.str().c_str());
+        file_list_table->refresh();
+        std::string status = "Selected " + std::to_string(selected_files.size()) + " file(s)";
+        status_box->copy_label(status.c_str());
     }
     
     void update_ui_state() {
@@ -295,26 +400,59 @@ private:
             browse_output_btn->show();
         }
         
-        bool can_process = !selected_files.empty() && !processing;
-        if (can_process) {
-            process_btn->activate();
+        // While a batch runs the process button doubles as Cancel
+        if (processing) {
+            process_btn->label(cancel_requested ? "Cancelling..." : "Cancel");
+            process_btn->color(FL_RED);
+            if (cancel_requested) process_btn->deactivate();
+            else process_btn->activate();
+        } else {
+            process_btn->label("🚀 Clean Metadata");
+            process_btn->color(FL_GREEN);
+            if (!selected_files.empty()) process_btn->activate();
+            else process_btn->deactivate();
+        }
+        if (processing) {
+            select_files_btn->deactivate();
+            add_folder_btn->deactivate();
         } else {
-            process_btn->deactivate();
+            select_files_btn->activate();
+            add_folder_btn->activate();
         }
         
         main_window->redraw();
     }
     
     void process_files() {
-        if (processing || selected_files.empty()) return;
+        if (processing) {
+            cancel_requested = true;
+            update_ui_state();
+            return;
+        }
+        if (selected_files.empty()) return;
+        if (batch_thread.joinable()) batch_thread.join();
+        
+        // Widgets are read here, on the main thread; the batch only
+        // sees this snapshot
+        Options opt;
+        opt.in_place = in_place_check->value();
+        opt.backup = backup_check->value();
+        opt.recursive = recursive_check->value();
+        opt.pdf_mode = static_cast<PdfMode>(pdf_mode_choice->value());
+        
+        if (!opt.in_place && output_dir_input->value()) {
+            opt.out_dir = output_dir_input->value();
+        }
         
         processing = true;
+        was_processing = true;
+        cancel_requested = false;
         progress = 0;
-        total_files = selected_files.size();
+        successful = 0;
+        total_files = 0;  // counted as files are queued
         
         // Clear log
         log_buffer->text("");
-        log_messages.clear();
         
         // Show progress bar
         progress_bar->show();
@@ -322,97 +460,129 @@ private:
         
         update_ui_state();
         
-        // Start processing in separate thread
-        std::thread(&CleanMetaGUI::process_files_worker, this).detach();
+        // Run the batch off the UI thread; the file list is not
+        // modified while processing is set
+        batch_thread = std::thread(&CleanMetaGUI::process_files_worker, this, opt);
     }
     
-    void process_files_worker() {
-        Options opt;
-        opt.in_place = in_place_check->value();
-        opt.backup = backup_check->value();
-        opt.recursive = recursive_check->value();
-        
-        if (!opt.in_place && output_dir_input->value()) {
-            opt.out_dir = output_dir_input->value();
+    void post_log(std::string message) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        log_queue.push_back(std::move(message));
+    }
+    
+    // Files from a folder scan (`scanned`) that no handler recognises
+    // are skipped without a log line
+    void process_file(const fs::path& path, const Options& opt, bool scanned) {
+        fs::path out = opt.in_place ? path : default_output(path, opt.out_dir);
+        CleanResult res = clean_file(path, out, opt);
+        std::string message;
+        if (!res.format && res.error == kUnsupportedFormat) {
+            if (scanned) {
+                total_files--;
+                return;
+            }
+            message = "[WARNING] Unsupported file type: " + path.filename().string();
+        } else if (!res.format) {
+            message = "[ERROR] " + path.filename().string() + " - " + res.error;
+        } else if (res.ok) {
+            successful++;
+            message = "[OK] " + path.filename().string() + " (" + res.format + ") - metadata removed";
+        } else {
+            message = "[ERROR] Failed to process " + std::string(res.format) + ": " +
+                      path.filename().string() + " - " + res.error;
         }
-        
-        int processed = 0;
-        int successful = 0;
-        
-        for (const auto& file_path : selected_files) {
-            fs::path path(file_path);
-            
-            std::string message;
-            try {
-                fs::path out = opt.in_place ? path : default_output(path, opt);
-                bool success = false;
-                
-                if (is_image(path)) {
-                    success = clean_image(path, out, opt);
-                    if (success) {
-                        message = "[OK] " + path.filename().string() + " (image) - metadata removed";
-                    } else {
-                        message = "[ERROR] Failed to process image: " + path.filename().string();
-                    }
-                } else if (is_pdf(path)) {
-                    success = clean_pdf(path, out, opt);
-                    if (success) {
-                        message = "[OK] " + path.filename().string() + " (PDF) - metadata removed";
-                    } else {
-                        message = "[ERROR] Failed to process PDF: " + path.filename().string();
-                    }
-                } else {
-                    message = "[WARNING] Unsupported file type: " + path.filename().string();
+        post_log(std::move(message));
+        progress++;
+    }
+    
+    void process_files_worker(Options opt) {
+        {
+            BatchPool pool(std::max(1u, std::thread::hardware_concurrency()));
+            std::vector<fs::path> roots;
+            for (const auto& entry : selected_files) {
+                if (cancel_requested) break;
+                if (is_folder_entry(entry)) {
+                    if (opt.recursive) roots.push_back(entry);
+                    else post_log("[WARNING] Skipping folder (recursive processing is off): " + entry);
+                    continue;
                 }
-                
-                if (success) successful++;
-                
-            } catch (const std::exception& e) {
-                message = "[ERROR] " + path.filename().string() + " - " + e.what();
+                total_files++;
+                pool.submit([this, &opt, entry](size_t) {
+                    if (cancel_requested) return;
+                    process_file(entry, opt, false);
+                });
             }
             
-            // Add message to queue
-            {
-                std::lock_guard<std::mutex> lock(log_mutex);
-                log_queue.push(message);
+            // Folder contents stream in from the scanner while the
+            // workers clean; files no handler recognises are skipped
+            if (!roots.empty() && !cancel_requested) {
+                DirScanner scanner(roots, std::min<size_t>(pool.size(), 8));
+                for (size_t i = 0; i < pool.size(); i++) {
+                    pool.submit([this, &opt, &scanner](size_t) {
+                        ScanItem item;
+                        while (scanner.next(item)) {
+                            if (cancel_requested) {
+                                scanner.stop();
+                                return;
+                            }
+                            if (is_internal_path(item.path)) continue;
+                            total_files++;
+                            process_file(item.path, opt, true);
+                        }
+                    });
+                }
+                pool.wait();
+                for (auto& e : scanner.errors()) {
+                    post_log("[ERROR] " + e.path.string() + " - " + e.message);
+                }
             }
-            
-            processed++;
-            progress = processed;
-            
-            // Small delay to make progress visible
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            pool.wait();
         }
         
         // Final summary message
-        {
-            std::lock_guard<std::mutex> lock(log_mutex);
-            log_queue.push("\n=== PROCESSING COMPLETE ===");
-            log_queue.push("Successfully processed " + std::to_string(successful) + 
-                          " out of " + std::to_string(processed) + " files.");
-        }
+        int processed = progress;
+        post_log("\n=== " + std::string(cancel_requested ? "PROCESSING CANCELLED" : "PROCESSING COMPLETE") + " ===");
+        post_log("Successfully processed " + std::to_string(successful) +
+                 " out of " + std::to_string(processed) + " files.");
         
         processing = false;
     }
     
-    void update_ui() {
-        // Update log messages from worker thread
+    // Appends everything queued since the last tick in one
+    // Fl_Text_Buffer::append and trims the oldest lines once the
+    // log outgrows kLogMaxBytes
+    void drain_log() {
+        std::deque<std::string> pending;
         {
             std::lock_guard<std::mutex> lock(log_mutex);
-            while (!log_queue.empty()) {
-                log_messages.push_back(log_queue.front());
-                log_queue.pop();
-                
-                // Update log display
-                std::string current_text = log_buffer->text() ? log_buffer->text() : "";
-                current_text += log_messages.back() + "\n";
-                log_buffer->text(current_text.c_str());
-                
-                // Auto-scroll to bottom
-                log_display->insert_position(log_buffer->length());
-                log_display->show_insert_position();
-            }
+            pending.swap(log_queue);
         }
+        if (pending.empty()) return;
+        
+        std::string chunk;
+        for (const auto& m : pending) {
+            chunk += m;
+            chunk += '\n';
+        }
+        if (chunk.size() > static_cast<size_t>(kLogMaxBytes)) {
+            size_t cut = chunk.find('\n', chunk.size() - kLogMaxBytes);
+            chunk.erase(0, cut == std::string::npos ? 0 : cut + 1);
+        }
+        log_buffer->append(chunk.c_str());
+        
+        if (log_buffer->length() > kLogMaxBytes) {
+            int excess = log_buffer->length() - kLogMaxBytes + kLogTrimBytes;
+            log_buffer->remove(0, log_buffer->line_end(excess) + 1);
+        }
+        
+        // Auto-scroll to bottom
+        log_display->insert_position(log_buffer->length());
+        log_display->show_insert_position();
+    }
+    
+    void update_ui() {
+        // Update log messages from worker threads
+        drain_log();
         
         // Update progress bar
         if (processing && total_files > 0) {
@@ -421,17 +591,22 @@ private:
             
             std::string status = "Processing: " + std::to_string(progress) + 
                                " / " + std::to_string(total_files);
-            status_box->label(status.c_str());
-        } else if (!processing && progress > 0) {
+            status_box->copy_label(status.c_str());
+            status_box->redraw_label();
+        } else if (was_processing) {
+            was_processing = false;
+            if (batch_thread.joinable()) batch_thread.join();
+            drain_log();
             progress_bar->hide();
-            status_box->label("Processing complete!");
+            status_box->label(cancel_requested ? "Processing cancelled" : "Processing complete!");
+            update_ui_state();
         }
-        
-        update_ui_state();
     }
 };
 
 int main() {
+    cleanmeta_init();
+
     // Set FLTK scheme for modern look
     Fl::scheme("gtk+");
     
@@ -0,0 +1,474 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_io.h"
+
+// -------------------------------------------------------------
+// Native ISOBMFF (HEIF/HEIC/AVIF) handler
+//
+// Exif and XMP live in HEIF as items: an `infe` entry in `iinf`,
+// extents in `iloc`, a `cdsc` link in `iref`, and the payload in
+// `mdat` (or `idat`). Only the top-level `meta` box is rewritten,
+// without those items; every other box, `mdat` included, streams
+// through with the removed items' extents overwritten by zeros.
+//
+// The rewritten `meta` is smaller, and a `free` box fills the
+// difference, so no byte after `meta` moves. That keeps every
+// absolute offset valid: `iloc` extents, and the `stco`/`co64`
+// chunk offsets in the `moov` of image sequences (msf1, heis, avis).
+// A removed item sheds at least its 21-byte `infe`, so there is
+// always room for the 8-byte `free` header; if there ever isn't,
+// the file goes to Exiv2 rather than being moved.
+// -------------------------------------------------------------
+static const uint64_t kBmffMaxMeta = 64ull * 1024 * 1024;
+
+struct BmffBox {
+    char type[4];
+    uint64_t offset;  // of the header
+    uint64_t size;    // header included
+    uint32_t header;  // 8, or 16 with a 64-bit size
+};
+
+// Bounds-checked big-endian reader; a read past the end clears ok
+struct BmffCursor {
+    const uint8_t* p;
+    size_t n;
+    size_t pos = 0;
+    bool ok = true;
+
+    BmffCursor(const uint8_t* data, size_t len) : p(data), n(len) {}
+
+    bool has(size_t k) const { return ok && n - pos >= k; }
+
+    uint64_t get(int bytes) {
+        if (!has(static_cast<size_t>(bytes))) {
+            ok = false;
+            return 0;
+        }
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; i++) v = (v << 8) | p[pos++];
+        return v;
+    }
+
+    void skip(size_t k) {
+        if (!has(k)) ok = false;
+        else pos += k;
+    }
+
+    std::string cstr() {
+        const void* end = has(1) ? std::memchr(p + pos, 0, n - pos) : nullptr;
+        if (!end) {
+            ok = false;
+            return {};
+        }
+        std::string s(reinterpret_cast<const char*>(p + pos), static_cast<const uint8_t*>(end) - (p + pos));
+        pos += s.size() + 1;
+        return s;
+    }
+};
+
+static void bmff_put(std::vector<uint8_t>& out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+static void bmff_append(std::vector<uint8_t>& out, const uint8_t* p, size_t n) {
+    out.insert(out.end(), p, p + n);
+}
+
+// Wraps `body` in a box header of the given type
+static void bmff_put_box(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& body) {
+    bmff_put(out, 8 + body.size(), 4);
+    bmff_append(out, reinterpret_cast<const uint8_t*>(type), 4);
+    bmff_append(out, body.data(), body.size());
+}
+
+// Splits a box payload into its child boxes
+static bool bmff_children(const uint8_t* p, size_t n, std::vector<BmffBox>& boxes) {
+    BmffCursor c(p, n);
+    while (c.pos < n) {
+        BmffBox b{};
+        b.offset = c.pos;
+        uint64_t size = c.get(4);
+        if (!c.has(4)) return false;
+        std::memcpy(b.type, p + c.pos, 4);
+        c.skip(4);
+        b.header = 8;
+        if (size == 1) {
+            size = c.get(8);
+            b.header = 16;
+        } else if (size == 0) {
+            size = n - b.offset;
+        }
+        if (!c.ok || size < b.header || size > n - b.offset) return false;
+        b.size = size;
+        c.pos = static_cast<size_t>(b.offset + size);
+        boxes.push_back(b);
+    }
+    return true;
+}
+
+static bool bmff_is(const BmffBox& b, const char* type) {
+    return std::memcmp(b.type, type, 4) == 0;
+}
+
+using BmffRanges = std::vector<std::pair<uint64_t, uint64_t>>;  // [begin, end)
+
+struct BmffEdit {
+    std::vector<uint32_t> removed;  // item IDs, sorted
+    BmffRanges file_ranges;         // removed payload in the file
+    BmffRanges idat_ranges;         // removed payload in idat
+
+    bool is_removed(uint32_t id) const {
+        return std::binary_search(removed.begin(), removed.end(), id);
+    }
+};
+
+// iinf: collects the Exif and XMP (mime, application/rdf+xml) items
+static bool bmff_find_items(const uint8_t* p, size_t n, BmffEdit& edit) {
+    BmffCursor c(p, n);
+    uint8_t version = static_cast<uint8_t>(c.get(1));
+    c.skip(3);
+    c.skip(version == 0 ? 2 : 4);
+    std::vector<BmffBox> entries;
+    if (!c.ok || !bmff_children(p + c.pos, n - c.pos, entries)) return false;
+    for (auto& e : entries) {
+        if (!bmff_is(e, "infe")) continue;
+        BmffCursor ic(p + c.pos + e.offset + e.header, e.size - e.header);
+        uint8_t v = static_cast<uint8_t>(ic.get(1));
+        ic.skip(3);
+        if (v < 2) continue;
+        uint32_t id = static_cast<uint32_t>(ic.get(v == 2 ? 2 : 4));
+        ic.skip(2);  // protection index
+        char type[4] = {};
+        if (ic.has(4)) std::memcpy(type, ic.p + ic.pos, 4);
+        ic.skip(4);
+        ic.cstr();  // item name
+        bool drop = std::memcmp(type, "Exif", 4) == 0;
+        if (std::memcmp(type, "mime", 4) == 0) drop = ic.cstr() == "application/rdf+xml";
+        if (!ic.ok) return false;
+        if (drop) edit.removed.push_back(id);
+    }
+    std::sort(edit.removed.begin(), edit.removed.end());
+    return true;
+}
+
+static bool bmff_rebuild_iinf(const uint8_t* p, size_t n, const BmffEdit& edit, std::vector<uint8_t>& out) {
+    BmffCursor c(p, n);
+    uint8_t version = static_cast<uint8_t>(c.get(1));
+    c.skip(3);
+    int count_bytes = version == 0 ? 2 : 4;
+    c.skip(static_cast<size_t>(count_bytes));
+    std::vector<BmffBox> entries;
+    if (!c.ok || !bmff_children(p + c.pos, n - c.pos, entries)) return false;
+
+    std::vector<uint8_t> kept;
+    uint32_t count = 0;
+    for (auto& e : entries) {
+        const uint8_t* eb = p + c.pos + e.offset;
+        if (bmff_is(e, "infe") && e.size >= e.header + 8) {
+            BmffCursor ic(eb + e.header, e.size - e.header);
+            uint8_t v = static_cast<uint8_t>(ic.get(1));
+            ic.skip(3);
+            if (v >= 2 && edit.is_removed(static_cast<uint32_t>(ic.get(v == 2 ? 2 : 4)))) continue;
+        }
+        bmff_append(kept, eb, e.size);
+        count++;
+    }
+    bmff_append(out, p, 4);
+    bmff_put(out, count, count_bytes);
+    bmff_append(out, kept.data(), kept.size());
+    return true;
+}
+
+// iloc: drops the removed items and records their extents
+static bool bmff_rebuild_iloc(const uint8_t* p, size_t n, BmffEdit& edit, std::vector<uint8_t>& out) {
+    BmffCursor c(p, n);
+    uint8_t version = static_cast<uint8_t>(c.get(1));
+    c.skip(3);
+    uint8_t sizes0 = static_cast<uint8_t>(c.get(1));
+    uint8_t sizes1 = static_cast<uint8_t>(c.get(1));
+    int offset_size = sizes0 >> 4, length_size = sizes0 & 15, base_size = sizes1 >> 4;
+    int index_size = (version == 1 || version == 2) ? (sizes1 & 15) : 0;
+    for (int s : {offset_size, length_size, base_size, index_size}) {
+        if (s != 0 && s != 4 && s != 8) return false;
+    }
+    int id_size = version < 2 ? 2 : 4;
+    uint64_t count = c.get(id_size);
+    if (!c.ok || version > 2) return false;
+
+    std::vector<uint8_t> items;
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t id = static_cast<uint32_t>(c.get(id_size));
+        uint16_t method_field = (version == 1 || version == 2) ? static_cast<uint16_t>(c.get(2)) : 0;
+        int method = method_field & 15;
+        uint16_t dref = static_cast<uint16_t>(c.get(2));
+        uint64_t base = c.get(base_size);
+        uint16_t extents = static_cast<uint16_t>(c.get(2));
+        bool removed = edit.is_removed(id);
+
+        std::vector<uint8_t> item;
+        bmff_put(item, id, id_size);
+        if (version == 1 || version == 2) bmff_put(item, method_field, 2);
+        bmff_put(item, dref, 2);
+        bmff_put(item, base, base_size);
+        bmff_put(item, extents, 2);
+        for (uint16_t k = 0; k < extents; k++) {
+            uint64_t index = c.get(index_size);
+            uint64_t off = c.get(offset_size);
+            uint64_t len = c.get(length_size);
+            if (removed && dref == 0 && len > 0) {
+                if (method == 0) edit.file_ranges.push_back({base + off, base + off + len});
+                if (method == 1) edit.idat_ranges.push_back({base + off, base + off + len});
+            }
+            bmff_put(item, index, index_size);
+            bmff_put(item, off, offset_size);
+            bmff_put(item, len, length_size);
+        }
+        if (!c.ok) return false;
+        if (removed) continue;
+        bmff_append(items, item.data(), item.size());
+        kept++;
+    }
+    bmff_append(out, p, 6);
+    bmff_put(out, kept, id_size);
+    bmff_append(out, items.data(), items.size());
+    return true;
+}
+
+// iref: drops references from removed items and removed targets
+static bool bmff_rebuild_iref(const uint8_t* p, size_t n, const BmffEdit& edit, std::vector<uint8_t>& out) {
+    BmffCursor c(p, n);
+    uint8_t version = static_cast<uint8_t>(c.get(1));
+    c.skip(3);
+    int id_size = version == 0 ? 2 : 4;
+    std::vector<BmffBox> refs;
+    if (!c.ok || !bmff_children(p + 4, n - 4, refs)) return false;
+
+    bmff_append(out, p, 4);
+    for (auto& r : refs) {
+        BmffCursor rc(p + 4 + r.offset + r.header, r.size - r.header);
+        uint32_t from = static_cast<uint32_t>(rc.get(id_size));
+        uint16_t count = static_cast<uint16_t>(rc.get(2));
+        std::vector<uint32_t> to;
+        for (uint16_t k = 0; k < count; k++) {
+            uint32_t id = static_cast<uint32_t>(rc.get(id_size));
+            if (!edit.is_removed(id)) to.push_back(id);
+        }
+        if (!rc.ok || r.header != 8) return false;
+        if (edit.is_removed(from) || to.empty()) continue;
+        std::vector<uint8_t> body;
+        bmff_put(body, from, id_size);
+        bmff_put(body, to.size(), 2);
+        for (uint32_t id : to) bmff_put(body, id, id_size);
+        char type[5] = {};
+        std::memcpy(type, r.type, 4);
+        bmff_put_box(out, type, body);
+    }
+    return true;
+}
+
+// ipma: drops the property associations of removed items
+static bool bmff_rebuild_ipma(const uint8_t* p, size_t n, const BmffEdit& edit, std::vector<uint8_t>& out) {
+    BmffCursor c(p, n);
+    uint8_t version = static_cast<uint8_t>(c.get(1));
+    uint32_t flags = static_cast<uint32_t>(c.get(3));
+    uint32_t count = static_cast<uint32_t>(c.get(4));
+    int id_size = version < 1 ? 2 : 4;
+    size_t assoc_size = (flags & 1) ? 2 : 1;
+
+    std::vector<uint8_t> entries;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count && c.ok; i++) {
+        size_t start = c.pos;
+        uint32_t id = static_cast<uint32_t>(c.get(id_size));
+        uint8_t assoc = static_cast<uint8_t>(c.get(1));
+        c.skip(assoc * assoc_size);
+        if (!c.ok) return false;
+        if (edit.is_removed(id)) continue;
+        bmff_append(entries, p + start, c.pos - start);
+        kept++;
+    }
+    if (!c.ok) return false;
+    bmff_append(out, p, 4);
+    bmff_put(out, kept, 4);
+    bmff_append(out, entries.data(), entries.size());
+    return true;
+}
+
+static bool bmff_rebuild_iprp(const uint8_t* p, size_t n, const BmffEdit& edit, std::vector<uint8_t>& out) {
+    std::vector<BmffBox> children;
+    if (!bmff_children(p, n, children)) return false;
+    for (auto& b : children) {
+        if (!bmff_is(b, "ipma")) {
+            bmff_append(out, p + b.offset, b.size);
+            continue;
+        }
+        std::vector<uint8_t> body;
+        if (!bmff_rebuild_ipma(p + b.offset + b.header, b.size - b.header, edit, body)) return false;
+        bmff_put_box(out, "ipma", body);
+    }
+    return true;
+}
+
+// Builds the new meta box from the original one (`meta`, header
+// included); fills edit's ranges along the way
+static bool bmff_rebuild_meta(const std::vector<uint8_t>& meta, uint32_t header, BmffEdit& edit,
+                              std::vector<uint8_t>& out) {
+    size_t body_at = header + 4;  // meta is a FullBox
+    if (meta.size() < body_at) return false;
+    std::vector<BmffBox> children;
+    if (!bmff_children(meta.data() + body_at, meta.size() - body_at, children)) return false;
+    edit.file_ranges.clear();
+    edit.idat_ranges.clear();
+
+    // iloc first: idat's ranges come from it, whatever the box order
+    std::vector<std::vector<uint8_t>> rebuilt(children.size());
+    for (size_t i = 0; i < children.size(); i++) {
+        const BmffBox& b = children[i];
+        if (!bmff_is(b, "iloc")) continue;
+        const uint8_t* body = meta.data() + body_at + b.offset + b.header;
+        if (!bmff_rebuild_iloc(body, b.size - b.header, edit, rebuilt[i])) return false;
+    }
+
+    std::vector<uint8_t> payload;
+    bmff_append(payload, meta.data() + header, 4);
+    for (size_t i = 0; i < children.size(); i++) {
+        const BmffBox& b = children[i];
+        const uint8_t* raw = meta.data() + body_at + b.offset;
+        const uint8_t* body = raw + b.header;
+        size_t len = b.size - b.header;
+        std::vector<uint8_t>& nb = rebuilt[i];
+        bool ok = true;
+        if (bmff_is(b, "iinf")) ok = bmff_rebuild_iinf(body, len, edit, nb);
+        else if (bmff_is(b, "iref")) ok = bmff_rebuild_iref(body, len, edit, nb);
+        else if (bmff_is(b, "iprp")) ok = bmff_rebuild_iprp(body, len, edit, nb);
+        else if (bmff_is(b, "idat")) {
+            nb.assign(body, body + len);
+            for (auto& r : edit.idat_ranges) {
+                if (r.first >= len) continue;
+                std::fill(nb.begin() + static_cast<long>(r.first),
+                          nb.begin() + static_cast<long>(std::min<uint64_t>(r.second, len)), 0);
+            }
+        } else if (!bmff_is(b, "iloc")) {
+            bmff_append(payload, raw, b.size);
+            continue;
+        }
+        if (!ok) return false;
+        char type[5] = {};
+        std::memcpy(type, b.type, 4);
+        bmff_put_box(payload, type, nb);
+    }
+    bmff_put_box(out, "meta", payload);
+    return true;
+}
+
+// Copies input bytes [in.offset(), end) with the given file ranges
+// (sorted, non-overlapping) written as zeros; returns zeroed bytes
+static bool bmff_copy_zeroing(InFile& in, OutFile& out, uint64_t end, const BmffRanges& zero,
+                              uint64_t& zeroed) {
+    static const uint8_t kZeros[4096] = {};
+    for (auto& r : zero) {
+        uint64_t at = in.offset();
+        if (r.second <= at || r.first >= end) continue;
+        uint64_t from = std::max(r.first, at);
+        uint64_t to = std::min(r.second, end);
+        if (in.copy_to(out, from - at) != from - at) return false;
+        if (!in.skip(to - from)) return false;
+        for (uint64_t left = to - from; left > 0;) {
+            size_t k = static_cast<size_t>(std::min<uint64_t>(left, sizeof kZeros));
+            out.write(kZeros, k);
+            left -= k;
+        }
+        zeroed += to - from;
+    }
+    uint64_t rest = end - in.offset();
+    return in.copy_to(out, rest) == rest;
+}
+
+// Returns false when the input is not an ISOBMFF file with a single
+// top-level meta box this handler can rewrite; the caller then falls
+// back to Exiv2.
+static bool strip_isobmff(InFile& in, OutFile& out, const KeepPolicy&, StripStats& st) {
+    // Top-level box headers, read ahead with pread
+    uint64_t file_size = in.size();
+    std::vector<BmffBox> boxes;
+    const BmffBox* meta_box = nullptr;
+    for (uint64_t at = 0; file_size - at >= 8;) {
+        uint8_t h[16];
+        size_t got = in.pread(h, sizeof h, at);
+        BmffBox b{};
+        b.offset = at;
+        b.header = 8;
+        std::memcpy(b.type, h + 4, 4);
+        uint64_t size = (uint64_t(h[0]) << 24) | (uint64_t(h[1]) << 16) | (uint64_t(h[2]) << 8) | h[3];
+        if (size == 1) {
+            if (got < 16) return false;
+            size = 0;
+            for (int i = 8; i < 16; i++) size = (size << 8) | h[i];
+            b.header = 16;
+        } else if (size == 0) {
+            size = file_size - at;
+        }
+        if (size < b.header || size > file_size - at) return false;
+        b.size = size;
+        boxes.push_back(b);
+        at += size;
+    }
+    if (boxes.empty() || !bmff_is(boxes[0], "ftyp")) return false;
+    for (auto& b : boxes) {
+        if (!bmff_is(b, "meta")) continue;
+        if (meta_box) return false;
+        meta_box = &b;
+    }
+    if (!meta_box || meta_box->size > kBmffMaxMeta) return false;
+
+    std::vector<uint8_t> meta(static_cast<size_t>(meta_box->size));
+    if (in.pread(meta.data(), meta.size(), meta_box->offset) != meta.size()) return false;
+
+    BmffEdit edit;
+    std::vector<BmffBox> children;
+    size_t body_at = meta_box->header + 4;
+    if (meta.size() < body_at || !bmff_children(meta.data() + body_at, meta.size() - body_at, children)) {
+        return false;
+    }
+    for (auto& b : children) {
+        if (bmff_is(b, "iinf") &&
+            !bmff_find_items(meta.data() + body_at + b.offset + b.header, b.size - b.header, edit)) {
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> new_meta;
+    if (!edit.removed.empty()) {
+        if (!bmff_rebuild_meta(meta, meta_box->header, edit, new_meta)) return false;
+        uint64_t delta = meta.size() - new_meta.size();
+        if (delta > 0 && delta < 8) return false;  // no room for a free box
+        if (delta >= 8) {
+            std::vector<uint8_t> pad(static_cast<size_t>(delta - 8), 0);
+            bmff_put_box(new_meta, "free", pad);
+        }
+    }
+
+    BmffRanges& zero = edit.file_ranges;
+    std::sort(zero.begin(), zero.end());
+    uint64_t zeroed = 0;
+    for (auto& b : boxes) {
+        if (&b == meta_box && !edit.removed.empty()) {
+            if (!in.skip(b.size)) return false;
+            out.write(new_meta.data(), new_meta.size());
+            continue;
+        }
+        if (!bmff_copy_zeroing(in, out, b.offset + b.size, zero, zeroed)) return false;
+    }
+    // Fewer than 8 bytes after the last box can't be a box
+    st.bytes_removed += in.skip_all() + zeroed;
+    st.segments_removed += edit.removed.size();
+    return true;
+}
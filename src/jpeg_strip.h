@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+
+#include "exif_filter.h"
+#include "file_io.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Native JPEG segment stripper
+//
+// Walks the marker segments once, dropping APP1 (Exif/XMP),
+// APP13 (IPTC/Photoshop 8BIM) and COM. Everything from SOS on,
+// including entropy-coded data and any trailer after EOI, is
+// streamed through untouched. APP0/APP2 (JFIF, ICC, MPF) and
+// APP14 (Adobe) are kept since decoders need them for colour. When
+// the policy keeps Exif tags, an Exif APP1 is rebuilt with just
+// those instead of dropped.
+// -------------------------------------------------------------
+static const uint8_t kJpegExifId[6] = {'E', 'x', 'i', 'f', 0, 0};
+
+static bool jpeg_drops_marker(uint8_t marker) {
+    return marker == 0xE1 || marker == 0xED || marker == 0xFE;
+}
+
+// Returns false when the input is not a JPEG this walker understands;
+// the caller then falls back to Exiv2.
+static bool strip_jpeg(InFile& in, OutFile& out, const KeepPolicy& keep, StripStats& st) {
+    uint8_t soi[2];
+    if (!in.read(soi, 2) || soi[0] != 0xFF || soi[1] != 0xD8) return false;
+    out.write(soi, 2);
+
+    for (;;) {
+        uint8_t b;
+        if (!in.read_u8(b) || b != 0xFF) return false;
+        uint8_t marker;
+        do {
+            if (!in.read_u8(marker)) return false;
+        } while (marker == 0xFF);  // fill bytes
+
+        // Standalone markers carry no length
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            out.write_u8(0xFF);
+            out.write_u8(marker);
+            continue;
+        }
+        if (marker == 0xD9) {  // EOI before any scan
+            out.write_u8(0xFF);
+            out.write_u8(marker);
+            in.copy_to(out, UINT64_MAX);
+            return true;
+        }
+
+        uint8_t len_be[2];
+        if (!in.read(len_be, 2)) return false;
+        uint16_t len = static_cast<uint16_t>((len_be[0] << 8) | len_be[1]);
+        if (len < 2) return false;
+
+        if (marker == 0xE1 && keep.keeps_exif) {
+            std::vector<uint8_t> seg(len - 2u), kept;
+            if (!in.read(seg.data(), seg.size())) return false;
+            if (seg.size() > sizeof kJpegExifId && std::memcmp(seg.data(), kJpegExifId, sizeof kJpegExifId) == 0) {
+                filter_exif(seg.data() + sizeof kJpegExifId, seg.size() - sizeof kJpegExifId, keep, kept);
+            }
+            if (!kept.empty() && kept.size() + sizeof kJpegExifId + 2 <= 0xFFFF) {
+                uint16_t new_len = static_cast<uint16_t>(kept.size() + sizeof kJpegExifId + 2);
+                uint8_t hdr[4] = {0xFF, 0xE1, uint8_t(new_len >> 8), uint8_t(new_len)};
+                out.write(hdr, 4);
+                out.write(kJpegExifId, sizeof kJpegExifId);
+                out.write(kept.data(), kept.size());
+                st.bytes_removed += uint64_t(len) - new_len;
+                continue;
+            }
+            st.segments_removed++;
+            st.bytes_removed += 2u + len;
+            continue;
+        }
+
+        if (jpeg_drops_marker(marker)) {
+            if (!in.skip(len - 2)) return false;
+            st.segments_removed++;
+            st.bytes_removed += 2u + len;
+            continue;
+        }
+
+        out.write_u8(0xFF);
+        out.write_u8(marker);
+        out.write(len_be, 2);
+        if (in.copy_to(out, len - 2) != static_cast<uint64_t>(len - 2)) return false;
+
+        if (marker == 0xDA) {  // SOS: the rest is scan data
+            in.copy_to(out, UINT64_MAX);
+            return true;
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// In-place JPEG scrub
+//
+// Each segment strip_jpeg would drop is relabelled APP15 and its
+// payload zeroed, keeping the length field, so decoders skip it as
+// an application segment with an empty identifier. Only the
+// headers up to SOS are read.
+// -------------------------------------------------------------
+static const uint8_t kJpegPadMarker = 0xEF;  // APP15
+
+static bool scrub_jpeg(const PatchFile& f, ScrubPlan& plan, StripStats& st) {
+    uint8_t soi[2];
+    if (!f.read_at(0, soi, 2) || soi[0] != 0xFF || soi[1] != 0xD8) return false;
+
+    uint64_t at = 2;
+    for (;;) {
+        uint8_t b;
+        if (!f.read_at(at++, &b, 1) || b != 0xFF) return false;
+        uint8_t marker;
+        do {
+            if (!f.read_at(at++, &marker, 1)) return false;
+        } while (marker == 0xFF);  // fill bytes
+
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        if (marker == 0xD9 || marker == 0xDA) return true;  // EOI, or SOS: scan data follows
+
+        uint8_t len_be[2];
+        if (!f.read_at(at, len_be, 2)) return false;
+        uint16_t len = static_cast<uint16_t>((len_be[0] << 8) | len_be[1]);
+        if (len < 2 || at + len > f.size()) return false;
+
+        if (jpeg_drops_marker(marker)) {
+            plan.zero(at + 2, len - 2u);
+            plan.write(at - 1, &kJpegPadMarker, 1);
+            st.segments_removed++;
+        }
+        at += len;
+    }
+}
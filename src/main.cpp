@@ -1,181 +1,901 @@
 #include <exiv2/exiv2.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <filesystem>
-#include <functional>
 #include <iostream>
+#include <list>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 #include <cstdlib>
+#include <condition_variable>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 
-#ifdef __APPLE__
-#include <mach-o/dyld.h>
-#endif
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "batch_pool.h"
+#include "cleanmeta.h"
+#include "cli_args.h"
+#include "dedup_cache.h"
+#include "dir_scan.h"
+#include "format_sniff.h"
+#include "mem_budget.h"
+#include "pdf_clean.h"
+#include "serve.h"
+#include "stamp.h"
+#include "trace.h"
+#include "verify.h"
 
 namespace fs = std::filesystem;
 
 // -------------------------------------------------------------
-// Utility: get directory of the current executable
+// Config options
 // -------------------------------------------------------------
-static fs::path exe_dir() {
-#ifdef __APPLE__
-    uint32_t size = 0;
-    _NSGetExecutablePath(nullptr, &size);
-    std::string buf(size, '\0');
-    _NSGetExecutablePath(buf.data(), &size);
-    return fs::weakly_canonical(fs::path(buf).parent_path());
-#else
-    return fs::current_path();
-#endif
-}
+struct Options : CleanOptions {
+    bool recursive = false;
+    VerifyMode verify = VerifyMode::sampled;
+    bool ordered = false;
+    bool incremental = false;  // skip files whose clean stamp still matches
+    size_t jobs = 0;  // 0 = hardware concurrency
+    IoEngine io = IoEngine::sync;
+    fs::path out_dir;
+};
 
-// Escape for shell command
-static std::string shell_escape(const std::string& s) {
-    std::string out = "'";
-    for (char c : s) {
-        if (c == '\'') out += "'\\''";
-        else out += c;
-    }
-    out += "'";
-    return out;
+// Hash of every option that changes what a cleaned file contains;
+// stamps written under a different policy no longer match
+static uint64_t policy_hash(const Options& opt) {
+    uint64_t h = 0xcbf29ce484222325ull;  // FNV-1a
+    auto mix = [&](uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+            h ^= (v >> (8 * i)) & 0xFF;
+            h *= 0x100000001b3ull;
+        }
+    };
+    mix(static_cast<uint64_t>(opt.pdf_mode));
+    mix(opt.pdf_squash);
+    if (opt.keep) mix(opt.keep->hash);
+    return h;
 }
 
 // -------------------------------------------------------------
-// Config options
+// Per-file result: log lines are collected here instead of being
+// written to std::cout/std::cerr from the worker threads
 // -------------------------------------------------------------
-struct Options {
-    bool in_place = false;
-    bool backup = true;
-    bool recursive = false;
-    fs::path out_dir;
+struct FileResult {
+    bool ok = false;
+    std::string out;
+    std::string err;
 };
 
 // -------------------------------------------------------------
-// File type helpers
+// Post-clean verification: a signature scan of the output first,
+// the full second parse only when the scan finds something
 // -------------------------------------------------------------
-static bool is_image(const fs::path& p) {
-    auto ext = p.extension().string();
-    for (auto& c : ext) c = std::tolower(c);
-    return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".heic";
+static size_t count_image_metadata(const fs::path& p) {
+    TraceSpan span("verify.parse");
+    auto image = Exiv2::ImageFactory::open(p.string());
+    image->readMetadata();
+    return image->exifData().count() + image->iptcData().size() + image->xmpData().count();
 }
-static bool is_pdf(const fs::path& p) {
-    auto ext = p.extension().string();
-    for (auto& c : ext) c = std::tolower(c);
-    return ext == ".pdf";
+
+// Appends the verdict to `line`; false when metadata remains
+static bool verify_image(const fs::path& target, const Options& opt, std::string& line) {
+    if (opt.verify == VerifyMode::off) return true;
+    VerifyHit hit;
+    if (!scan_for_signatures(target, kImageSignatures, opt.verify, hit)) {
+        line += std::string("; verify: clean (") + verify_mode_name(opt.verify) + ")";
+        return true;
+    }
+    MemoryCharge charge(fs::file_size(target));
+    size_t after = count_image_metadata(target);
+    line += "; verify: " + std::string(hit.name) + " signature at " + std::to_string(hit.offset) +
+            ", " + std::to_string(after) + " tags remaining";
+    return after == 0;
+}
+
+static bool verify_pdf(const fs::path& target, const Options& opt, std::string& line) {
+    if (opt.verify == VerifyMode::off) return true;
+    VerifyHit hit;
+    if (!scan_for_signatures(target, kPdfSignatures, opt.verify, hit)) {
+        line += std::string("; verify: clean (") + verify_mode_name(opt.verify) + ")";
+        return true;
+    }
+    MemoryCharge charge(fs::file_size(target));
+    bool remaining = pdf_has_metadata(target);
+    line += "; verify: " + std::string(hit.name) + " at " + std::to_string(hit.offset) +
+            (remaining ? ", still referenced" : ", unreferenced");
+    return !remaining;
+}
+
+// Files a finished line under out or err depending on verification
+static bool report(FileResult& r, const std::string& line, bool verified) {
+    if (verified) r.out += "[OK] " + line + "\n";
+    else r.err += "[ERR] " + line + "\n";
+    return verified;
 }
 
 // -------------------------------------------------------------
-// Find bundled qpdf
+// One line per cleaned file, from the library's result
 // -------------------------------------------------------------
-static std::string qpdf_path_cached;
+static std::string describe(const fs::path& in, const CleanResult& res) {
+    std::string name = in.filename().string();
+    switch (res.method) {
+        case CleanMethod::scrub:
+            return name + " (" + res.format + ") scrubbed " + std::to_string(res.segments_removed) +
+                   " segments, " + std::to_string(res.bytes_removed) + " bytes zeroed in place";
+        case CleanMethod::native:
+            return name + " (" + res.format + ") removed " + std::to_string(res.segments_removed) +
+                   " segments, " + std::to_string(res.bytes_removed) + " bytes";
+        case CleanMethod::exiv2:
+            return name + " (" + res.format + ", exiv2) removed " + std::to_string(res.tags_removed) + " tags";
+        case CleanMethod::qpdf:
+            return name + " (pdf, " + pdf_mode_name(res.pdf_mode) + ") metadata cleared" +
+                   (res.pdf_mode == PdfMode::incremental ? ", earlier revisions still in file" : "");
+        case CleanMethod::none:
+            break;
+    }
+    return name;
+}
+
+// -------------------------------------------------------------
+// Batch engine
+//
+// Every worker keeps its own counters and output buffers, so no
+// lock is shared on std::cout and the totals are summed exactly
+// once the pool has drained. Buffers are flushed in large chunks,
+// or, with --ordered, held back and printed sorted by input.
+// -------------------------------------------------------------
+struct FileRecord {
+    size_t arg;        // index of the command-line input it came from
+    std::string path;
+    FileResult result;
+};
+
+struct WorkerState {
+    size_t total = 0;
+    size_t ok = 0;
+    size_t skipped = 0;
+    std::string out;
+    std::string err;
+    std::vector<FileRecord> records;
+};
+
+static const size_t kFlushBytes = 64 * 1024;
+
+static void flush_buffer(std::string& buf, std::FILE* stream) {
+    if (buf.empty()) return;
+    std::fwrite(buf.data(), 1, buf.size(), stream);
+    buf.clear();
+}
+
+// Cleans one file and renders its log lines; shared by the batch
+// engine and the daemon
+struct FileOutcome {
+    FileResult r;
+    bool skipped = false;
+    const char* dedup = nullptr;  // "hit" or "miss" with --dedup
+    CleanResult res;
+};
+
+// Handler names are static; the cache index only has a copy
+static const char* format_name(const std::string& name) {
+    for (const auto& h : kFormatHandlers) {
+        if (name == h.name) return h.name;
+    }
+    return "unknown";
+}
+
+// Satisfies a repeat from the dedup cache: the earlier cleaned copy
+// goes to the output through a temp file. False on a miss, or when
+// the copy vanished (evicted by another worker) before it was made.
+static bool reuse_cleaned(const fs::path& p, const fs::path& out, const Options& opt,
+                          const std::string& key, FileOutcome& o) {
+    fs::path object;
+    std::string format;
+    if (!dedup_cache().lookup(key, object, format)) return false;
+    uint64_t bytes_in = fs::file_size(p);
+    if (opt.in_place && opt.backup) make_backup(p, true);
+    fs::path tmp = temp_path_for(out);
+    try {
+        TraceSpan span("dedup.reuse");
+        copy_file_fast(object, tmp);
+        if (opt.in_place) fs::permissions(tmp, fs::status(p).permissions());
+        fs::rename(tmp, out);
+    } catch (const std::exception&) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        return false;
+    }
+    o.res.ok = o.r.ok = true;
+    o.res.format = format_name(format);
+    o.res.bytes_in = bytes_in;
+    o.res.bytes_out = fs::file_size(out);
+    o.r.out += "[OK] " + p.filename().string() + " (" + o.res.format + ") same as an earlier input; reused its clean copy\n";
+    return true;
+}
+
+// What happens before the clean: the --incremental check and the
+// dedup lookup. False when there is nothing left to clean.
+static bool begin_clean(const fs::path& p, const fs::path& out, const Options& opt, uint64_t policy,
+                        std::string& dedup_key, FileOutcome& o) {
+    if (opt.incremental && stamp_matches(p, out, policy)) {
+        o.skipped = true;
+        return false;
+    }
+    // Scrubbing edits the original inode, which a cached copy can't
+    if (dedup_cache().enabled() && !opt.scrub) {
+        dedup_key = DedupCache::key(content_digest(p, dedup_cache().algo()), policy);
+        if (reuse_cleaned(p, out, opt, dedup_key, o)) {
+            dedup_cache().hits++;
+            o.dedup = "hit";
+            if (opt.incremental) stamp_output(p, out, policy);
+            trace_bytes(o.res.bytes_in, o.res.bytes_out);
+            return false;
+        }
+        dedup_cache().misses++;
+        o.dedup = "miss";
+    }
+    return true;
+}
 
-static const std::string& find_qpdf() {
-    if (!qpdf_path_cached.empty()) return qpdf_path_cached;
+// Reports o.res, then verifies, stamps and caches the output
+static void finish_clean(const fs::path& p, const fs::path& out, const Options& opt, uint64_t policy,
+                         const std::string& dedup_key, FileOutcome& o) {
+    FileResult& r = o.r;
+    const CleanResult& res = o.res;
+    fs::path target = opt.in_place ? p : out;
+    if (!res.note.empty()) {
+        r.out += "[INFO] " + p.filename().string() + " (" + res.format + ") " + res.note + "\n";
+    }
+    if (!res.format && res.error == kUnsupportedFormat) {
+        r.err += "[WARN] unsupported: " + p.string() + "\n";
+    } else if (!res.ok) {
+        r.err += "[ERR] " + p.string() + " : " + res.error + "\n";
+    } else {
+        std::string line = describe(p, res);
+        bool verified = res.method == CleanMethod::qpdf ? verify_pdf(target, opt, line)
+                                                        : verify_image(target, opt, line);
+        r.ok = report(r, line, verified);
+    }
+    if (r.ok && opt.incremental) stamp_output(p, out, policy);
+    if (r.ok) trace_bytes(res.bytes_in, res.bytes_out);
+    if (r.ok && !dedup_key.empty()) {
+        try {
+            dedup_cache().insert(dedup_key, target, res.format);
+        } catch (const std::exception& e) {
+            r.err += "[WARN] " + p.string() + " : not cached: " + e.what() + "\n";
+        }
+    }
+}
 
-    fs::path candidate = exe_dir() / "bin" / "qpdf";
-    if (fs::exists(candidate)) {
-        qpdf_path_cached = candidate.string();
-        return qpdf_path_cached;
+static FileOutcome clean_path(const fs::path& p, const Options& opt, uint64_t policy) {
+    FileOutcome o;
+    const FormatHandler* hint = format_from_extension(p);
+    TraceFile trace(hint ? hint->name : "other", p);
+    try {
+        fs::path out = opt.in_place ? p : default_output(p, opt.out_dir);
+        std::string dedup_key;
+        if (!begin_clean(p, out, opt, policy, dedup_key, o)) return o;
+        o.res = clean_file(p, out, opt);
+        finish_clean(p, out, opt, policy, dedup_key, o);
+    } catch (const std::exception& e) {
+        o.r.err += "[ERR] " + p.string() + " : " + e.what() + "\n";
     }
-    if (std::system("command -v qpdf >/dev/null 2>&1") == 0) {
-        qpdf_path_cached = "qpdf";
-        return qpdf_path_cached;
+    return o;
+}
+
+static std::string human_bytes(uint64_t n) {
+    static const char* const kUnits[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double v = static_cast<double>(n);
+    int u = 0;
+    while (v >= 1024 && u < 4) {
+        v /= 1024;
+        u++;
     }
-    qpdf_path_cached.clear();
-    return qpdf_path_cached;
+    char buf[32];
+    std::snprintf(buf, sizeof buf, u ? "%.1f %s" : "%.0f %s", v, kUnits[u]);
+    return buf;
+}
+
+// --max-mem: what was charged against the budget, and the peak RSS
+// the kernel saw, which also counts code, Exiv2's caches and the
+// allocator's slack
+static void print_memory_summary(std::FILE* f) {
+    MemoryBudget::Stats s = memory_budget().stats();
+    struct rusage ru {};
+    ::getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    uint64_t rss = static_cast<uint64_t>(ru.ru_maxrss);
+#else
+    uint64_t rss = static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+#endif
+    std::fprintf(f, "Memory: peak %s, average %s of %s budgeted; %llu waited; peak RSS %s.\n",
+                 human_bytes(s.peak).c_str(), human_bytes(s.average).c_str(), human_bytes(s.limit).c_str(),
+                 static_cast<unsigned long long>(s.waits), human_bytes(rss).c_str());
+}
+
+static void print_dedup_summary(size_t hits, size_t misses) {
+    std::cout << "Dedup: " << hits << " hits, " << misses << " misses";
+    if (size_t evicted = dedup_cache().evictions) std::cout << ", " << evicted << " evicted";
+    std::cout << ".\n";
+}
+
+static void record_outcome(FileOutcome& o, const fs::path& p, size_t arg, const Options& opt, WorkerState& w) {
+    w.total++;
+    if (o.skipped) {
+        w.skipped++;
+        return;
+    }
+    FileResult& r = o.r;
+    if (r.ok) w.ok++;
+
+    if (opt.ordered) {
+        w.records.push_back({arg, p.string(), std::move(r)});
+        return;
+    }
+    w.out += r.out;
+    w.err += r.err;
+    if (w.out.size() >= kFlushBytes) flush_buffer(w.out, stdout);
+    if (w.err.size() >= kFlushBytes) flush_buffer(w.err, stderr);
+}
+
+static void process_file(const fs::path& p, size_t arg, const Options& opt, uint64_t policy,
+                         WorkerState& w) {
+    FileOutcome o = clean_path(p, opt, policy);
+    record_outcome(o, p, arg, opt, w);
+}
+
+// With --io uring a worker hands clean_files kIoBatch files at a
+// time, so their opens, reads, writes and renames share one ring.
+// Checks, verification and reporting stay per file, as above.
+static const size_t kIoBatch = 256;
+
+struct PendingFile {
+    fs::path path;
+    size_t arg;
+};
+
+static std::atomic<bool> g_io_fell_back{false};
+
+static void process_batch(const std::vector<PendingFile>& files, const Options& opt, uint64_t policy,
+                          WorkerState& w) {
+    std::vector<FileOutcome> outcomes(files.size());
+    std::vector<fs::path> outs(files.size());
+    std::vector<std::string> keys(files.size());
+    std::vector<BatchItem> items;
+    std::vector<size_t> which;
+    for (size_t i = 0; i < files.size(); i++) {
+        const fs::path& p = files[i].path;
+        try {
+            outs[i] = opt.in_place ? p : default_output(p, opt.out_dir);
+            if (!begin_clean(p, outs[i], opt, policy, keys[i], outcomes[i])) continue;
+            items.push_back({p, outs[i], {}});
+            which.push_back(i);
+        } catch (const std::exception& e) {
+            outcomes[i].r.err += "[ERR] " + p.string() + " : " + e.what() + "\n";
+        }
+    }
+    if (!items.empty() && clean_files(items, opt, opt.io) != opt.io) g_io_fell_back = true;
+    for (size_t k = 0; k < items.size(); k++) {
+        size_t i = which[k];
+        outcomes[i].res = std::move(items[k].result);
+        try {
+            finish_clean(files[i].path, outs[i], opt, policy, keys[i], outcomes[i]);
+        } catch (const std::exception& e) {
+            outcomes[i].r.err += "[ERR] " + files[i].path.string() + " : " + e.what() + "\n";
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) record_outcome(outcomes[i], files[i].path, files[i].arg, opt, w);
 }
 
 // -------------------------------------------------------------
-// Output path logic
+// `cleanmeta -`: one object from stdin to stdout, streamed when the
+// format allows it. The result line goes to stderr, since stdout
+// carries the data.
 // -------------------------------------------------------------
-static fs::path default_output(const fs::path& in, const Options& opt) {
-    if (!opt.out_dir.empty()) {
-        fs::create_directories(opt.out_dir);
-        return opt.out_dir / in.filename();
+static int clean_stdio(const Options& opt) {
+    TraceFile trace("other", fs::path("-"));
+    FdSink sink(STDOUT_FILENO);
+    CleanResult res = clean_fd(STDIN_FILENO, sink, opt);
+    if (!res.ok) {
+        std::cerr << "[ERR] - : " << res.error << "\n";
+        return 2;
     }
-    auto out = in;
-    out.replace_filename(in.stem().string() + ".clean" + in.extension().string());
-    return out;
+    trace_bytes(res.bytes_in, res.bytes_out);
+    std::cerr << "[OK] " << describe("-", res) << "\n";
+    return 0;
 }
 
 // -------------------------------------------------------------
-// Clean image using Exiv2
+// Daemon (--serve) and thin client (--connect)
+//
+// The daemon keeps one worker pool, Exiv2 and the stamp index warm
+// across requests; the protocol is described in serve.h. Requests
+// carry their own options, so one daemon serves clients with
+// different settings. The client sends every file it finds without
+// waiting for answers and prints the daemon's log lines as they
+// come back, so its output and exit code match a local run.
 // -------------------------------------------------------------
-static bool clean_image(const fs::path& in, const fs::path& out, const Options& opt) {
-    try {
-        fs::path target = opt.in_place ? in : out;
 
-        if (!opt.in_place) {
-            fs::copy_file(in, out, fs::copy_options::overwrite_existing);
-        } else if (opt.backup) {
-            fs::path bak = in;
-            bak += ".bak";
-            if (!fs::exists(bak)) fs::copy_file(in, bak);
+// Compiled policies by their entries, so a daemon compiles each
+// distinct --keep once rather than per request. The entries come
+// from clients, so only the most recently used few are kept.
+static std::shared_ptr<const KeepPolicy> cached_keep_policy(const std::vector<std::string>& entries) {
+    using Entry = std::pair<std::vector<std::string>, std::shared_ptr<const KeepPolicy>>;
+    static constexpr size_t kMaxPolicies = 16;
+    static std::mutex mutex;
+    static std::list<Entry> lru;  // most recent first
+    static std::map<std::vector<std::string>, std::list<Entry>::iterator> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(entries);
+    if (it != cache.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+    auto keep = std::make_shared<KeepPolicy>();
+    std::string error;
+    if (!compile_keep_policy(entries, *keep, error)) return nullptr;
+    lru.emplace_front(entries, keep);
+    cache[entries] = lru.begin();
+    if (lru.size() > kMaxPolicies) {
+        cache.erase(lru.back().first);
+        lru.pop_back();
+    }
+    return keep;
+}
+
+// Per-request options, as they travel in a request line. keep= lists
+// the policy's canonical entries separated by ';'. out= comes last
+// and takes the rest of the field, so the directory may contain
+// commas.
+static std::string serialize_options(const Options& opt) {
+    std::string s = "pdf-mode=" + std::string(pdf_mode_name(opt.pdf_mode));
+    s += ",verify=" + std::string(verify_mode_name(opt.verify));
+    if (opt.in_place) s += ",in-place";
+    if (opt.scrub) s += ",scrub";
+    if (!opt.backup) s += ",no-backup";
+    if (opt.pdf_squash) s += ",squash";
+    if (opt.incremental) s += ",incremental";
+    if (opt.keep && !opt.keep->empty()) {
+        s += ",keep=";
+        for (size_t i = 0; i < opt.keep->entries.size(); i++) {
+            s += (i ? ";" : "") + opt.keep->entries[i];
         }
+    }
+    if (!opt.out_dir.empty()) s += ",out=" + fs::absolute(opt.out_dir).string();
+    return s;
+}
 
-        auto image = Exiv2::ImageFactory::open(target.string());
-        if (!image) {
-            std::cerr << "[ERR] cannot open " << in << "\n";
-            return false;
+static bool parse_options(const std::string& s, Options& opt) {
+    size_t at = 0;
+    while (at < s.size()) {
+        if (s.compare(at, 4, "out=") == 0) {
+            opt.out_dir = s.substr(at + 4);
+            return opt.out_dir.is_absolute();
+        }
+        size_t end = s.find(',', at);
+        if (end == std::string::npos) end = s.size();
+        std::string key = s.substr(at, end - at);
+        at = end + 1;
+        if (key == "in-place") opt.in_place = true;
+        else if (key == "scrub") opt.in_place = opt.scrub = true;
+        else if (key == "no-backup") opt.backup = false;
+        else if (key == "squash") opt.pdf_squash = true;
+        else if (key == "incremental") opt.incremental = true;
+        else if (key == "verify=full") opt.verify = VerifyMode::full;
+        else if (key == "verify=sampled") opt.verify = VerifyMode::sampled;
+        else if (key == "verify=off") opt.verify = VerifyMode::off;
+        else if (key.rfind("pdf-mode=", 0) == 0) {
+            if (!parse_pdf_mode(key.substr(9), opt.pdf_mode)) return false;
+        }
+        else if (key.rfind("keep=", 0) == 0) {
+            std::vector<std::string> entries;
+            for (size_t i = 5; i <= key.size();) {
+                size_t semi = std::min(key.find(';', i), key.size());
+                entries.push_back(key.substr(i, semi - i));
+                i = semi + 1;
+            }
+            if (!(opt.keep = cached_keep_policy(entries))) return false;
+        }
+        else if (!key.empty()) return false;
+    }
+    return true;
+}
+
+static std::string response_json(const std::string& id, const FileOutcome& o, const std::string& error) {
+    const CleanResult& res = o.res;
+    std::string j = "{\"id\":";
+    json_append_string(j, id);
+    j += std::string(",\"ok\":") + (o.r.ok ? "true" : "false");
+    j += std::string(",\"skipped\":") + (o.skipped ? "true" : "false");
+    if (res.format) {
+        j += ",\"format\":";
+        json_append_string(j, res.format);
+        j += ",\"method\":";
+        json_append_string(j, clean_method_name(res.method));
+        if (res.method == CleanMethod::qpdf) {
+            j += ",\"pdf_mode\":";
+            json_append_string(j, pdf_mode_name(res.pdf_mode));
+        }
+    }
+    j += ",\"bytes_in\":" + std::to_string(res.bytes_in);
+    j += ",\"bytes_out\":" + std::to_string(res.bytes_out);
+    j += ",\"segments_removed\":" + std::to_string(res.segments_removed);
+    j += ",\"bytes_removed\":" + std::to_string(res.bytes_removed);
+    j += ",\"tags_removed\":" + std::to_string(res.tags_removed);
+    j += ",\"elapsed_us\":" + std::to_string(res.elapsed_ns / 1000);
+    if (o.dedup) {
+        j += ",\"dedup\":";
+        json_append_string(j, o.dedup);
+    }
+    if (res.policy) {
+        char hex[24];
+        std::snprintf(hex, sizeof hex, "%016llx", static_cast<unsigned long long>(res.policy));
+        j += ",\"policy\":";
+        json_append_string(j, hex);
+    }
+    if (!error.empty()) {
+        j += ",\"error\":";
+        json_append_string(j, error);
+    }
+    j += ",\"out\":";
+    json_append_string(j, o.r.out);
+    j += ",\"err\":";
+    json_append_string(j, o.r.err);
+    j += "}\n";
+    return j;
+}
+
+// Cleans between two descriptors a client passed; there is no path
+// to verify, so the result line is the cleaner's own
+static FileOutcome clean_passed_fds(int in, int out, const std::string& label, const Options& opt) {
+    FileOutcome o;
+    TraceFile trace("other", fs::path(label));
+    FdSink sink(out);
+    o.res = clean_fd(in, sink, opt);
+    if (o.res.ok) {
+        o.r.ok = report(o.r, describe(label, o.res), true);
+        trace_bytes(o.res.bytes_in, o.res.bytes_out);
+    } else {
+        o.r.err += "[ERR] " + label + " : " + o.res.error + "\n";
+    }
+    return o;
+}
+
+struct ServerConn {
+    int fd;
+    std::mutex write_mutex;  // one response line at a time
+    std::mutex mutex;
+    std::condition_variable idle;
+    size_t pending = 0;
+    bool incremental = false;  // some request stamped files
+
+    void respond(const std::string& line) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        try {
+            send_with_fds(fd, line);
+        } catch (const std::system_error&) {
+            // the client went away; its remaining requests still run
         }
-        image->readMetadata();
-        size_t before = image->exifData().count() + image->iptcData().size() + image->xmpData().count();
+    }
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) idle.notify_all();
+    }
+};
 
-        image->exifData().clear();
-        image->iptcData().clear();
-        image->xmpData().clear();
-        image->writeMetadata();
+// Reads one connection's requests and hands them to the pool;
+// returns once the client has stopped sending and every response is
+// out, leaving the descriptor to the caller to close
+static void serve_connection(std::shared_ptr<ServerConn> c, BatchPool& pool) {
+    uid_t uid;
+    bool trusted = peer_uid(c->fd, uid) && (uid == ::geteuid() || uid == 0);
+    SocketReader reader(c->fd);
+    std::string line;
+    while (reader.read_line(line)) {
+        std::vector<std::string> f;
+        size_t at = 0;
+        for (int i = 0; i < 3; i++) {
+            size_t tab = line.find('\t', at);
+            if (tab == std::string::npos) break;
+            f.push_back(line.substr(at, tab - at));
+            at = tab + 1;
+        }
+        f.push_back(line.substr(at));
+        auto opt = std::make_shared<Options>();
+        int in = -1, out = -1;
+        std::string error;
+        if (f.size() != 4 || !parse_options(f[2], *opt)) error = "bad request";
+        else if (f[1] == "fd") {
+            in = reader.take_fd();
+            out = reader.take_fd();
+            if (in < 0 || out < 0) error = "fd request without two descriptors";
+        } else if (f[1] != "path") error = "unknown op";
+        else if (!trusted) error = "path requests are only taken from the daemon's user";
+        else if (!fs::path(f[3]).is_absolute()) error = "path must be absolute";
+        if (!error.empty()) {
+            if (in >= 0) ::close(in);
+            if (out >= 0) ::close(out);
+            FileOutcome o;
+            o.r.err = "[ERR] " + (f.size() == 4 ? f[3] : line) + " : " + error + "\n";
+            c->respond(response_json(f[0], o, error));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(c->mutex);
+            c->pending++;
+            if (opt->incremental) c->incremental = true;
+        }
+        pool.submit([c, opt, in, out, id = f[0], arg = f[3]](size_t) {
+            FileOutcome o;
+            try {
+                o = in >= 0 ? clean_passed_fds(in, out, arg, *opt)
+                            : clean_path(arg, *opt, policy_hash(*opt));
+            } catch (const std::exception& e) {
+                o.r.err += "[ERR] " + arg + " : " + e.what() + "\n";
+            }
+            if (in >= 0) {
+                ::close(in);
+                ::close(out);
+            }
+            c->respond(response_json(id, o, o.r.ok || o.skipped ? std::string() : o.res.error));
+            c->finish();
+        });
+    }
+    std::unique_lock<std::mutex> lock(c->mutex);
+    c->idle.wait(lock, [&] { return c->pending == 0; });
+    if (c->incremental) stamp_index().save();
+    if (dedup_cache().enabled()) dedup_cache().save();
+}
 
-        image = Exiv2::ImageFactory::open(target.string());
-        image->readMetadata();
-        size_t after = image->exifData().count() + image->iptcData().size() + image->xmpData().count();
+static int g_stop_pipe[2] = {-1, -1};
 
-        std::cout << "[OK] " << in.filename().string()
-                  << " (img) removed " << before << " tags, remaining " << after << "\n";
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "[ERR] " << in << " : " << e.what() << "\n";
-        return false;
+static void on_stop_signal(int) {
+    char b = 0;
+    ssize_t n = ::write(g_stop_pipe[1], &b, 1);
+    (void)n;
+}
+
+static int run_server(const std::string& sock, mode_t mode, const Options& opt) {
+    int listen_fd;
+    try {
+        listen_fd = unix_listen(sock, mode);
+    } catch (const std::system_error& e) {
+        std::cerr << "[ERR] " << e.what() << "\n";
+        return 1;
+    }
+    if (::pipe2(g_stop_pipe, O_CLOEXEC) != 0) {
+        std::cerr << "[ERR] pipe: " << std::strerror(errno) << "\n";
+        return 1;
     }
+    std::signal(SIGPIPE, SIG_IGN);  // clients and passed pipes may close early
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+    std::cerr << "[INFO] serving on " << sock << " with " << opt.jobs << " workers\n";
+
+    std::mutex conns_mutex;
+    std::condition_variable conns_done;
+    std::vector<int> live;  // connection fds, shut down on stop
+    {
+        BatchPool pool(opt.jobs);
+        for (;;) {
+            struct pollfd pfd[2] = {{listen_fd, POLLIN, 0}, {g_stop_pipe[0], POLLIN, 0}};
+            if (::poll(pfd, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (pfd[1].revents) break;
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) continue;
+            auto c = std::make_shared<ServerConn>();
+            c->fd = fd;
+            {
+                std::lock_guard<std::mutex> lock(conns_mutex);
+                live.push_back(fd);
+            }
+            std::thread([&, c] {
+                serve_connection(c, pool);
+                // Closed only once it is out of `live`, so the shutdown
+                // on stop can't hit a descriptor number reused meanwhile
+                std::lock_guard<std::mutex> lock(conns_mutex);
+                live.erase(std::find(live.begin(), live.end(), c->fd));
+                ::close(c->fd);
+                if (live.empty()) conns_done.notify_all();
+            }).detach();
+        }
+        std::unique_lock<std::mutex> lock(conns_mutex);
+        for (int fd : live) ::shutdown(fd, SHUT_RDWR);
+        conns_done.wait(lock, [&] { return live.empty(); });
+    }
+    ::close(listen_fd);
+    ::unlink(sock.c_str());
+    std::cerr << "[INFO] stopped";
+    if (dedup_cache().enabled()) {
+        std::cerr << "; dedup " << dedup_cache().hits << " hits, " << dedup_cache().misses << " misses, "
+                  << dedup_cache().evictions << " evicted";
+    }
+    std::cerr << "\n";
+    return 0;
 }
 
-// -------------------------------------------------------------
-// Clean PDF using qpdf
-// -------------------------------------------------------------
-static bool clean_pdf(const fs::path& in, const fs::path& out, const Options& opt) {
-    std::string qpdf = find_qpdf();
-    if (qpdf.empty()) {
-        std::cerr << "[ERR] qpdf not found (bundle it under bin/)\n";
-        return false;
+// `--connect SOCK -`: stdin and stdout are passed to the daemon
+static int client_stdio(int sock, const Options& opt) {
+    int fds[2] = {STDIN_FILENO, STDOUT_FILENO};
+    send_with_fds(sock, "0\tfd\t" + serialize_options(opt) + "\t-\n", fds, 2);
+    ::shutdown(sock, SHUT_WR);
+    SocketReader reader(sock);
+    std::string line;
+    std::map<std::string, std::string> resp;
+    if (!reader.read_line(line) || !json_parse_flat(line, resp)) {
+        std::cerr << "[ERR] - : no response from daemon\n";
+        return 2;
+    }
+    std::cerr << resp["out"] << resp["err"];
+    return resp["ok"] == "true" ? 0 : 2;
+}
+
+static int run_client(const std::string& sock_path, const Options& opt, const std::vector<fs::path>& inputs) {
+    int sock;
+    try {
+        sock = unix_connect(sock_path);
+    } catch (const std::system_error& e) {
+        std::cerr << "[ERR] " << e.what() << "\n";
+        return 2;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    if (inputs.size() == 1 && inputs[0] == "-") {
+        int rc = client_stdio(sock, opt);
+        ::close(sock);
+        return rc;
     }
 
-    if (opt.in_place) {
-        if (opt.backup) {
-            fs::path bak = in;
-            bak += ".bak";
-            if (!fs::exists(bak)) fs::copy_file(in, bak);
-        }
-        fs::path tmp = in;
-        tmp += ".tmp.pdf";
-        std::string cmd = shell_escape(qpdf) +
-            " --clear-metadata --empty-xmp --linearize " +
-            shell_escape(in.string()) + " " + shell_escape(tmp.string());
-        int rc = std::system(cmd.c_str());
-        if (rc == 0) {
-            fs::rename(tmp, in);
-            std::cout << "[OK] " << in.filename().string() << " (pdf) metadata cleared\n";
+    // The sender walks the inputs and pipelines a request per file;
+    // a request's id is its index in `sent`
+    const std::string flags = serialize_options(opt);
+    std::mutex sent_mutex;
+    std::vector<FileRecord> sent;
+    std::string local_err;
+    size_t unsent = 0;  // paths the protocol can't carry
+    std::thread sender([&] {
+        auto send = [&](const fs::path& p, size_t arg) {
+            std::string path = fs::absolute(p).lexically_normal().string();
+            if (path.find_first_of("\t\n") != std::string::npos) {
+                local_err += "[ERR] " + p.string() + " : path can't be sent to the daemon\n";
+                unsent++;
+                return true;
+            }
+            size_t id;
+            {
+                std::lock_guard<std::mutex> lock(sent_mutex);
+                id = sent.size();
+                sent.push_back({arg, p.string(), {}});
+            }
+            try {
+                send_with_fds(sock, std::to_string(id) + "\tpath\t" + flags + "\t" + path + "\n");
+            } catch (const std::system_error& e) {
+                local_err += std::string("[ERR] ") + e.what() + "\n";
+                return false;
+            }
             return true;
+        };
+        std::vector<fs::path> roots;
+        std::vector<size_t> root_args;
+        bool up = true;
+        for (size_t arg = 0; arg < inputs.size() && up; arg++) {
+            const fs::path& p = inputs[arg];
+            if (fs::is_directory(p)) {
+                if (!opt.recursive) { local_err += "[WARN] skipping dir \"" + p.string() + "\"\n"; continue; }
+                roots.push_back(p);
+                root_args.push_back(arg);
+            } else if (fs::is_regular_file(p)) {
+                up = send(p, arg);
+            }
         }
-        return false;
-    } else {
-        std::string cmd = shell_escape(qpdf) +
-            " --clear-metadata --empty-xmp --linearize " +
-            shell_escape(in.string()) + " " + shell_escape(out.string());
-        int rc = std::system(cmd.c_str());
-        if (rc == 0) {
-            std::cout << "[OK] " << in.filename().string() << " (pdf) metadata cleared\n";
-            return true;
+        if (up && !roots.empty()) {
+            DirScanner scanner(roots, 4);
+            ScanItem item;
+            while (up && scanner.next(item)) {
+                if (is_internal_path(item.path)) continue;
+                up = send(item.path, root_args[item.root]);
+            }
+            for (auto& e : scanner.errors()) local_err += "[ERR] " + e.path.string() + " : " + e.message + "\n";
         }
-        return false;
+        ::shutdown(sock, SHUT_WR);
+    });
+
+    size_t received = 0, ok = 0, skipped = 0, hits = 0, misses = 0;
+    std::vector<FileRecord> records;
+    SocketReader reader(sock);
+    std::string line;
+    while (reader.read_line(line)) {
+        std::map<std::string, std::string> resp;
+        if (!json_parse_flat(line, resp)) continue;
+        received++;
+        if (resp["skipped"] == "true") { skipped++; continue; }
+        if (resp["dedup"] == "hit") hits++;
+        if (resp["dedup"] == "miss") misses++;
+        FileResult r;
+        r.ok = resp["ok"] == "true";
+        r.out = resp["out"];
+        r.err = resp["err"];
+        if (r.ok) ok++;
+        if (opt.ordered) {
+            size_t id = std::strtoul(resp["id"].c_str(), nullptr, 10);
+            std::lock_guard<std::mutex> lock(sent_mutex);
+            if (id < sent.size()) records.push_back({sent[id].arg, sent[id].path, std::move(r)});
+            continue;
+        }
+        flush_buffer(r.out, stdout);
+        flush_buffer(r.err, stderr);
+    }
+    sender.join();
+    ::close(sock);
+
+    if (opt.ordered) {
+        std::sort(records.begin(), records.end(), [](const FileRecord& a, const FileRecord& b) {
+            return std::tie(a.arg, a.path) < std::tie(b.arg, b.path);
+        });
+        for (auto& rec : records) {
+            flush_buffer(rec.result.out, stdout);
+            flush_buffer(rec.result.err, stderr);
+        }
+    }
+    flush_buffer(local_err, stderr);
+    size_t total = sent.size() + unsent;
+    if (received < total) {
+        std::cerr << "[ERR] daemon closed the connection with " << (total - received) << " requests unanswered\n";
+    }
+
+    std::cout << "\nDone. Cleaned " << ok << " / " << total << " files";
+    if (skipped) std::cout << ", skipped " << skipped << " already clean";
+    std::cout << ".\n";
+    if (hits + misses) print_dedup_summary(hits, misses);
+    return (ok + skipped == total) ? 0 : 2;
+}
+
+// More workers than this only adds contention
+constexpr size_t kMaxJobs = 1024;
+
+// -j N; 0 keeps the default
+static size_t parse_jobs(const char* s) {
+    char* end;
+    errno = 0;
+    unsigned long v = std::strtoul(s, &end, 10);
+    if (!std::isdigit(static_cast<unsigned char>(*s)) || *end || errno) {
+        throw std::invalid_argument(std::string("bad -j: ") + s);
     }
+    return std::min<unsigned long>(v, kMaxJobs);
+}
+
+// "512M", "2G", plain bytes
+static bool parse_size(const std::string& s, uint64_t& bytes) {
+    if (!std::isdigit(static_cast<unsigned char>(s[0]))) return false;  // strtoull takes "-1"
+    char* end;
+    errno = 0;
+    unsigned long long v = std::strtoull(s.c_str(), &end, 10);
+    if (errno == ERANGE) return false;
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (v > (UINT64_MAX >> shift)) return false;
+    bytes = v << shift;
+    return *end == '\0';
 }
 
 // -------------------------------------------------------------
@@ -183,14 +903,50 @@ static bool clean_pdf(const fs::path& in, const fs::path& out, const Options& op
 // -------------------------------------------------------------
 static void usage(const char* prog) {
     std::cout <<
-"cleanmeta — strip metadata from images (JPEG/PNG/HEIC) and PDFs\n\n"
+"cleanmeta — strip metadata from images (JPEG, PNG, GIF, WebP, TIFF/raw,\n"
+"HEIF/AVIF) and PDFs\n\n"
 "Usage:\n"
-"  " << prog << " [options] <files or folders...>\n\n"
+"  " << prog << " [options] <files or folders...>\n"
+"  " << prog << " [options] -     Clean stdin to stdout\n"
+"  " << prog << " --serve SOCK [-j N]\n"
+"  " << prog << " --connect SOCK [options] <files or folders... | ->\n\n"
 "Options:\n"
 "  -o DIR, --out DIR     Write cleaned copies to DIR\n"
 "  --in-place            Clean files in place (default: copy)\n"
+"  --scrub-in-place      Like --in-place, but overwrite only the metadata bytes\n"
+"                        (JPEG, PNG, TIFF; file length unchanged); other\n"
+"                        formats are rewritten\n"
 "  --no-backup           Skip .bak backup when in-place\n"
 "  -r, --recursive       Recurse into folders\n"
+"  --pdf-mode MODE       PDF output: linearize (default), rewrite, preserve,\n"
+"                        incremental (append-only; old revisions remain)\n"
+"  --squash-history      With incremental, do a full rewrite instead\n"
+"  --verify              Scan every byte of the output for residual metadata\n"
+"                        (default: sample head and tail)\n"
+"  --no-verify           Skip the post-clean scan\n"
+"  -j N, --jobs N        Worker threads (default: hardware concurrency)\n"
+"  --ordered             Print per-file results in input order\n"
+"  --trace FILE          Write per-stage spans as Chrome trace JSON (Perfetto)\n"
+"  --stats               Print per-format, per-stage latency and byte totals\n"
+"  --keep LIST           Keep these tags, comma-separated: orientation, icc,\n"
+"                        copyright, Exif.Group.Tag, Iptc.* or Xmp.* keys\n"
+"  --keep-file FILE      Read more --keep entries from FILE (one per line)\n"
+"  --dedup DIR           Cache cleaned copies in DIR by content hash; identical\n"
+"                        inputs are cleaned once and reused (daemon: set on --serve)\n"
+"  --dedup-max SIZE      Evict least recently used copies past SIZE (default 1G)\n"
+"  --dedup-hash ALGO     xxh64 (default, fast) or sha256\n"
+"  --incremental         Skip files already cleaned with the same settings\n"
+"                        (user.cleanmeta xattr, or a .cleanmeta-index sidecar)\n"
+"  --max-mem SIZE        Hold cleans back so their memory stays under SIZE\n"
+"                        (e.g. 2G); reports peak and average use at the end\n"
+"  --io ENGINE           sync (default) or uring: batch the file I/O of many\n"
+"                        small files through io_uring (Linux 5.6+)\n"
+"  --serve SOCK          Run as a daemon on the Unix socket SOCK; clients send\n"
+"                        their own options with each request\n"
+"  --serve-mode MODE     Permissions of the daemon's socket (default 0600);\n"
+"                        only the daemon's user may send file paths\n"
+"  --connect SOCK        Hand the work to the daemon on SOCK instead of\n"
+"                        cleaning here; output and exit code are the same\n"
 "  -h, --help            Show help\n";
 }
 
@@ -200,42 +956,264 @@ static void usage(const char* prog) {
 int main(int argc, char** argv) {
     Options opt;
     std::vector<fs::path> inputs;
+    std::string trace_path;
+    std::string serve_sock, connect_sock;
+    mode_t serve_mode = 0600;
+    std::vector<std::string> keep_entries;
+    fs::path dedup_dir;
+    uint64_t dedup_max = kDedupDefaultMax;
+    uint64_t max_mem = 0;
+    DedupHash dedup_hash = DedupHash::xxh64;
 
-    for (int i = 1; i < argc; i++) {
-        std::string a = argv[i];
-        if (a == "-h" || a == "--help") { usage(argv[0]); return 0; }
-        else if (a == "-o" || a == "--out") { opt.out_dir = argv[++i]; }
-        else if (a == "--in-place") opt.in_place = true;
-        else if (a == "--no-backup") opt.backup = false;
-        else if (a == "-r" || a == "--recursive") opt.recursive = true;
-        else inputs.push_back(a);
-    }
-    if (inputs.empty()) { usage(argv[0]); return 1; }
-
-    size_t total = 0, ok = 0;
-    std::function<void(const fs::path&)> handle = [&](const fs::path& p) {
-        if (fs::is_directory(p)) {
-            if (!opt.recursive) { std::cerr << "[WARN] skipping dir " << p << "\n"; return; }
-            for (auto& e : fs::recursive_directory_iterator(p)) {
-                if (fs::is_regular_file(e)) handle(e.path());
-            }
-            return;
-        }
-        if (!fs::is_regular_file(p)) return;
-
-        total++;
-        fs::path out = opt.in_place ? p : default_output(p, opt);
-        if (is_image(p)) {
-            if (clean_image(p, out, opt)) ok++;
-        } else if (is_pdf(p)) {
-            if (clean_pdf(p, out, opt)) ok++;
-        } else {
-            std::cerr << "[WARN] unsupported: " << p << "\n";
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string a = argv[i];
+            if (a == "-h" || a == "--help") { usage(argv[0]); return 0; }
+            else if (a == "-o" || a == "--out") { opt.out_dir = next_arg(argc, argv, i); }
+            else if (a == "--in-place") opt.in_place = true;
+            else if (a == "--scrub-in-place") opt.in_place = opt.scrub = true;
+            else if (a == "--no-backup") opt.backup = false;
+            else if (a == "-r" || a == "--recursive") opt.recursive = true;
+            else if (a == "-j" || a == "--jobs") { opt.jobs = parse_jobs(next_arg(argc, argv, i)); }
+            else if (a.rfind("-j", 0) == 0 && a.size() > 2) { opt.jobs = parse_jobs(a.c_str() + 2); }
+            else if (a == "--ordered") opt.ordered = true;
+            else if (a == "--trace") { trace_path = next_arg(argc, argv, i); trace_config().events = true; }
+            else if (a == "--stats") trace_config().stats = true;
+            else if (a == "--incremental") opt.incremental = true;
+            else if (a == "--squash-history") opt.pdf_squash = true;
+            else if (a == "--keep") {
+                std::string list = next_arg(argc, argv, i);
+                for (size_t at = 0; at <= list.size();) {
+                    size_t comma = std::min(list.find(',', at), list.size());
+                    keep_entries.push_back(list.substr(at, comma - at));
+                    at = comma + 1;
+                }
+            }
+            else if (a == "--keep-file") {
+                std::string error;
+                if (!read_keep_file(next_arg(argc, argv, i), keep_entries, error)) {
+                    std::cerr << error << "\n";
+                    return 1;
+                }
+            }
+            else if (a == "--dedup") dedup_dir = next_arg(argc, argv, i);
+            else if (a == "--dedup-max") {
+                if (!parse_size(next_arg(argc, argv, i), dedup_max)) {
+                    std::cerr << "bad --dedup-max: " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (a == "--dedup-hash") {
+                std::string algo = next_arg(argc, argv, i);
+                if (algo == "xxh64") dedup_hash = DedupHash::xxh64;
+                else if (algo == "sha256") dedup_hash = DedupHash::sha256;
+                else {
+                    std::cerr << "unknown --dedup-hash: " << algo << "\n";
+                    return 1;
+                }
+            }
+            else if (a == "--max-mem") {
+                if (!parse_size(next_arg(argc, argv, i), max_mem) || max_mem == 0) {
+                    std::cerr << "bad --max-mem: " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (a == "--io") {
+                if (!parse_io_engine(next_arg(argc, argv, i), opt.io)) {
+                    std::cerr << "unknown --io: " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else if (a == "--serve") serve_sock = next_arg(argc, argv, i);
+            else if (a == "--serve-mode") {
+                const char* s = next_arg(argc, argv, i);
+                char* end;
+                unsigned long mode = std::strtoul(s, &end, 8);
+                if (end == s || *end || mode > 0777) {
+                    std::cerr << "bad --serve-mode: " << s << "\n";
+                    return 1;
+                }
+                serve_mode = static_cast<mode_t>(mode);
+            }
+            else if (a == "--connect") connect_sock = next_arg(argc, argv, i);
+            else if (a == "--verify") opt.verify = VerifyMode::full;
+            else if (a == "--no-verify") opt.verify = VerifyMode::off;
+            else if (a == "--pdf-mode") {
+                if (!parse_pdf_mode(next_arg(argc, argv, i), opt.pdf_mode)) {
+                    std::cerr << "unknown --pdf-mode: " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else inputs.push_back(a);
+        }
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    if (!keep_entries.empty()) {
+        auto keep = std::make_shared<KeepPolicy>();
+        std::string error;
+        if (!compile_keep_policy(keep_entries, *keep, error)) {
+            std::cerr << "--keep: " << error << "\n";
+            return 1;
+        }
+        if (!keep->empty()) {
+            // stdout carries the data with '-'
+            bool stdio = std::find(inputs.begin(), inputs.end(), "-") != inputs.end();
+            std::fprintf(stdio ? stderr : stdout, "[INFO] keeping %zu tags (policy %016llx)\n",
+                         keep->entries.size(), static_cast<unsigned long long>(keep->hash));
+            std::fflush(stdout);
+            opt.keep = std::move(keep);
+        }
+    }
+    if (!connect_sock.empty()) {
+        if (inputs.empty()) { usage(argv[0]); return 1; }
+        if (!dedup_dir.empty() || max_mem) {
+            std::cerr << (max_mem ? "--max-mem" : "--dedup") << " belongs on the daemon's command line (--serve)\n";
+            return 1;
+        }
+        if (inputs.size() > 1 && std::find(inputs.begin(), inputs.end(), "-") != inputs.end()) {
+            std::cerr << "'-' (stdin) can't be combined with other inputs\n";
+            return 1;
+        }
+        return run_client(connect_sock, opt, inputs);
+    }
+    if (serve_sock.empty() && inputs.empty()) { usage(argv[0]); return 1; }
+    if (!serve_sock.empty() && !inputs.empty()) {
+        std::cerr << "--serve takes no inputs; send them with --connect\n";
+        return 1;
+    }
+    if (opt.jobs == 0) opt.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    // Exiv2's XMP toolkit must be initialised before it is used from several threads
+    cleanmeta_init();
+    if (max_mem) memory_budget().set_limit(max_mem);
+    if (!dedup_dir.empty()) {
+        try {
+            dedup_cache().open(dedup_dir, dedup_max, dedup_hash);
+        } catch (const std::exception& e) {
+            std::cerr << "--dedup: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!serve_sock.empty()) {
+        int rc = run_server(serve_sock, serve_mode, opt);
+        if (max_mem) print_memory_summary(stderr);
+        if (trace_config().stats) print_trace_stats(stderr);
+        if (!trace_path.empty() && !write_trace_json(trace_path)) {
+            std::cerr << "[ERR] cannot write trace " << trace_path << "\n";
+        }
+        return rc;
+    }
+
+    if (std::find(inputs.begin(), inputs.end(), "-") != inputs.end()) {
+        if (inputs.size() > 1) {
+            std::cerr << "'-' (stdin) can't be combined with other inputs\n";
+            return 1;
+        }
+        int rc = clean_stdio(opt);
+        if (max_mem) print_memory_summary(stderr);
+        if (trace_config().stats) print_trace_stats(stderr);
+        if (!trace_path.empty() && !write_trace_json(trace_path)) {
+            std::cerr << "[ERR] cannot write trace " << trace_path << "\n";
+        }
+        return rc;
+    }
+
+    const uint64_t policy = policy_hash(opt);
+    std::vector<WorkerState> states(opt.jobs);
+    {
+        BatchPool pool(opt.jobs);
+
+        std::vector<fs::path> roots;
+        std::vector<size_t> root_args;
+        std::vector<PendingFile> batch;
+        for (size_t arg = 0; arg < inputs.size(); arg++) {
+            const fs::path p = inputs[arg];
+            if (fs::is_directory(p)) {
+                if (!opt.recursive) { std::cerr << "[WARN] skipping dir " << p << "\n"; continue; }
+                roots.push_back(p);
+                root_args.push_back(arg);
+            } else if (fs::is_regular_file(p) && opt.io != IoEngine::sync) {
+                batch.push_back({p, arg});
+                if (batch.size() == kIoBatch) {
+                    pool.submit([&, files = std::move(batch)](size_t wk) { process_batch(files, opt, policy, states[wk]); });
+                    batch.clear();
+                }
+            } else if (fs::is_regular_file(p)) {
+                pool.submit([&, p, arg](size_t wk) { process_file(p, arg, opt, policy, states[wk]); });
+            }
+        }
+        if (!batch.empty()) {
+            pool.submit([&, files = std::move(batch)](size_t wk) { process_batch(files, opt, policy, states[wk]); });
         }
-    };
 
-    for (auto& f : inputs) handle(f);
+        // Directory trees stream through the scanner: every worker
+        // pulls files as they are found, so cleaning starts at once
+        // and the bounded scan queue holds the walk back when the
+        // cleaners fall behind.
+        if (!roots.empty()) {
+            DirScanner scanner(roots, std::min<size_t>(opt.jobs, 8));
+            for (size_t i = 0; i < pool.size(); i++) {
+                pool.submit([&](size_t wk) {
+                    ScanItem item;
+                    std::vector<PendingFile> files;
+                    while (scanner.next(item)) {
+                        if (is_internal_path(item.path, dedup_cache().dir())) continue;
+                        if (opt.io == IoEngine::sync) {
+                            process_file(item.path, root_args[item.root], opt, policy, states[wk]);
+                            continue;
+                        }
+                        files.push_back({item.path, root_args[item.root]});
+                        if (files.size() == kIoBatch) {
+                            process_batch(files, opt, policy, states[wk]);
+                            files.clear();
+                        }
+                    }
+                    if (!files.empty()) process_batch(files, opt, policy, states[wk]);
+                });
+            }
+            pool.wait();
+            for (auto& e : scanner.errors()) {
+                states[0].err += "[ERR] " + e.path.string() + " : " + e.message + "\n";
+            }
+        }
+        pool.wait();
+    }
 
-    std::cout << "\nDone. Cleaned " << ok << " / " << total << " files.\n";
-    return (ok == total) ? 0 : 2;
+    if (opt.incremental) stamp_index().save();
+    if (dedup_cache().enabled()) dedup_cache().save();
+
+    size_t total = 0, ok = 0, skipped = 0;
+    std::vector<FileRecord> records;
+    for (auto& w : states) {
+        total += w.total;
+        ok += w.ok;
+        skipped += w.skipped;
+        flush_buffer(w.out, stdout);
+        flush_buffer(w.err, stderr);
+        for (auto& rec : w.records) records.push_back(std::move(rec));
+    }
+    if (opt.ordered) {
+        std::sort(records.begin(), records.end(), [](const FileRecord& a, const FileRecord& b) {
+            return std::tie(a.arg, a.path) < std::tie(b.arg, b.path);
+        });
+        for (auto& rec : records) {
+            flush_buffer(rec.result.out, stdout);
+            flush_buffer(rec.result.err, stderr);
+        }
+    }
+
+    std::cout << "\nDone. Cleaned " << ok << " / " << total << " files";
+    if (skipped) std::cout << ", skipped " << skipped << " already clean";
+    std::cout << ".\n";
+    if (g_io_fell_back) std::cout << "io_uring is unavailable here; used synchronous I/O.\n";
+    if (dedup_cache().enabled()) print_dedup_summary(dedup_cache().hits, dedup_cache().misses);
+    if (max_mem) print_memory_summary(stdout);
+    if (trace_config().stats) print_trace_stats(stdout);
+    if (!trace_path.empty() && !write_trace_json(trace_path)) {
+        std::cerr << "[ERR] cannot write trace " << trace_path << "\n";
+    }
+    return (ok + skipped == total) ? 0 : 2;
 }
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// -------------------------------------------------------------
+// Global memory budget (--max-mem)
+//
+// Every clean charges the bytes it is expected to hold before it
+// starts: about two I/O buffers for a native handler streaming file
+// to file, and a multiple of the file size when Exiv2 or qpdf load
+// it whole (see memory_cost in cleanmeta.cpp). A charge that would
+// take the total past the limit waits its turn; turns are served in
+// arrival order, so a 2 GB TIFF is not starved by the small files
+// behind it. A charge larger than the whole budget runs alone, once
+// nothing but pinned memory is charged. Pinned charges belong to
+// buffers that live as long as a thread (the io_uring slots) and
+// are never waited for.
+//
+// Like trace.h, the functions are inline rather than static so the
+// library and the executable share one budget. With no limit set a
+// charge is a single branch and nothing is tracked.
+// -------------------------------------------------------------
+class MemoryBudget {
+public:
+    // 0 lifts the limit
+    void set_limit(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limit_ = bytes;
+        start_ = last_ = std::chrono::steady_clock::now();
+    }
+
+    uint64_t limit() const { return limit_; }
+
+    // Blocks until `bytes` fit
+    void acquire(uint64_t bytes) {
+        if (!limit_) return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t ticket = next_ticket_++;
+        if (ticket != serving_ || !fits(bytes)) {
+            waits_++;
+            cv_.wait(lock, [&] { return ticket == serving_ && fits(bytes); });
+        }
+        serving_++;
+        add(bytes);
+        cv_.notify_all();
+    }
+
+    // Takes `bytes` only if that needs no wait
+    bool try_acquire(uint64_t bytes) {
+        if (!limit_) return true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (next_ticket_ != serving_ || used_ + bytes > limit_) return false;
+        add(bytes);
+        return true;
+    }
+
+    // A charge for the life of a thread; false, and nothing taken,
+    // when it doesn't fit right away
+    bool try_pin(uint64_t bytes) {
+        if (!limit_) return true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (next_ticket_ != serving_ || used_ + bytes > limit_) return false;
+        add(bytes);
+        pinned_ += bytes;
+        return true;
+    }
+
+    void unpin(uint64_t bytes) {
+        if (!limit_) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pinned_ -= bytes;
+        }
+        release(bytes);
+    }
+
+    void release(uint64_t bytes) {
+        if (!limit_ || !bytes) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        add(0);
+        used_ -= bytes;
+        cv_.notify_all();
+    }
+
+    struct Stats {
+        uint64_t limit = 0;
+        uint64_t peak = 0;     // most bytes charged at once
+        uint64_t average = 0;  // time-weighted, since the limit was set
+        uint64_t waits = 0;    // charges that had to wait
+    };
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        add(0);
+        Stats s;
+        s.limit = limit_;
+        s.peak = peak_;
+        s.waits = waits_;
+        double span = std::chrono::duration<double>(last_ - start_).count();
+        s.average = span > 0 ? static_cast<uint64_t>(area_ / span) : used_;
+        return s;
+    }
+
+private:
+    bool fits(uint64_t bytes) const { return used_ == pinned_ || used_ + bytes <= limit_; }
+
+    // Accrues the time at the current level, then raises it
+    void add(uint64_t bytes) {
+        auto now = std::chrono::steady_clock::now();
+        area_ += static_cast<double>(used_) * std::chrono::duration<double>(now - last_).count();
+        last_ = now;
+        used_ += bytes;
+        if (used_ > peak_) peak_ = used_;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t limit_ = 0;
+    uint64_t used_ = 0;
+    uint64_t pinned_ = 0;
+    uint64_t peak_ = 0;
+    uint64_t waits_ = 0;
+    uint64_t next_ticket_ = 0;
+    uint64_t serving_ = 0;
+    double area_ = 0;  // byte-seconds
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+inline MemoryBudget& memory_budget() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+// One clean's charge, released when it goes out of scope
+class MemoryCharge {
+public:
+    explicit MemoryCharge(uint64_t bytes) : held_(bytes) { memory_budget().acquire(bytes); }
+    ~MemoryCharge() { memory_budget().release(held_); }
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+    // Changes the charge mid-clean, e.g. when a native handler
+    // rejects the file and Exiv2 takes over. Growing takes the extra
+    // at once if it fits; otherwise the whole charge is given back
+    // and requested again, so a thread never waits while holding
+    // bytes that others wait for.
+    void resize(uint64_t bytes) {
+        MemoryBudget& b = memory_budget();
+        if (bytes <= held_) {
+            b.release(held_ - bytes);
+        } else if (!b.try_acquire(bytes - held_)) {
+            b.release(held_);
+            b.acquire(bytes);
+        }
+        held_ = bytes;
+    }
+
+private:
+    uint64_t held_;
+};
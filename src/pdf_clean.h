@@ -0,0 +1,433 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFExc.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+#include <qpdf/Pipeline.hh>
+#include <qpdf/QPDFWriter.hh>
+
+#include "cleanmeta.h"
+#include "file_io.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// In-process PDF cleaning via libqpdf
+//
+// Replaces the per-file `qpdf` subprocess. A QPDF object is built
+// per document and never shared; qpdf keeps no state between
+// documents that would be worth carrying over on a worker.
+// -------------------------------------------------------------
+struct PdfError {
+    enum Code { none, open_failed, password, damaged, write_failed, internal };
+    Code code = none;
+    std::string message;
+
+    explicit operator bool() const { return code != none; }
+};
+
+static const char* pdf_error_name(PdfError::Code code) {
+    switch (code) {
+        case PdfError::none:         return "ok";
+        case PdfError::open_failed:  return "cannot open";
+        case PdfError::password:     return "encrypted (password required)";
+        case PdfError::damaged:      return "damaged PDF";
+        case PdfError::write_failed: return "write failed";
+        case PdfError::internal:     return "internal error";
+    }
+    return "unknown";
+}
+
+static void configure_writer(QPDFWriter& w, PdfMode mode) {
+    switch (mode) {
+        case PdfMode::linearize:
+            w.setLinearization(true);
+            break;
+        case PdfMode::rewrite:
+            w.setObjectStreamMode(qpdf_o_disable);
+            break;
+        case PdfMode::preserve:
+        case PdfMode::incremental:  // only reached when falling back
+            w.setObjectStreamMode(qpdf_o_preserve);
+            w.setDecodeLevel(qpdf_dl_none);
+            w.setCompressStreams(false);
+            break;
+    }
+}
+
+// Outcome of one document; `mode` is the mode actually used, which
+// differs from the requested one when incremental had to fall back
+struct PdfResult {
+    PdfError error;
+    PdfMode mode = PdfMode::linearize;
+    size_t warnings = 0;  // damage qpdf worked around while reading
+};
+
+static PdfError pdf_error_from(const QPDFExc& e) {
+    PdfError err;
+    err.message = e.getMessageDetail();
+    switch (e.getErrorCode()) {
+        case qpdf_e_password: err.code = PdfError::password; break;
+        case qpdf_e_system:   err.code = PdfError::open_failed; break;
+        default:              err.code = PdfError::damaged; break;
+    }
+    return err;
+}
+
+// Drops the document information dictionary and the catalog's XMP stream
+static void strip_pdf_metadata(QPDF& pdf) {
+    pdf.getTrailer().removeKey("/Info");
+    pdf.getRoot().removeKey("/Metadata");
+}
+
+// Full parse used by verification: true when the current revision
+// still references an /Info dictionary or an XMP stream
+static bool pdf_has_metadata(const fs::path& p) {
+    TraceSpan span("verify.parse");
+    QPDF pdf;
+    pdf.setSuppressWarnings(true);
+    pdf.processFile(p.c_str());
+    return !pdf.getTrailer().getKey("/Info").isNull() || pdf.getRoot().hasKey("/Metadata");
+}
+
+// -------------------------------------------------------------
+// Incremental update
+//
+// Instead of rewriting the document, append a new revision that
+// redefines the catalog without /Metadata, blanks the /Info
+// dictionary and the XMP stream, and ends in a trailer without
+// /Info. The cross-reference section matches the kind the file
+// already uses (table or stream), and /Prev chains to it.
+// -------------------------------------------------------------
+struct PdfUpdateObject {
+    int num;
+    int gen;
+    std::string body;
+};
+
+// Parses the last startxref out of the final bytes of a file
+static bool parse_pdf_startxref(const std::string& tail, uint64_t size, uint64_t& startxref) {
+    size_t at = tail.rfind("startxref");
+    if (at == std::string::npos) return false;
+    startxref = std::strtoull(tail.c_str() + at + 9, nullptr, 10);
+    return startxref > 0 && startxref < size;
+}
+
+// Locates the last startxref and reports whether it points at an
+// xref stream rather than a classic table
+static bool read_pdf_tail(const fs::path& p, uint64_t size, uint64_t& startxref, bool& xref_stream) {
+    std::FILE* f = std::fopen(p.c_str(), "rb");
+    if (!f) return false;
+    std::string tail(static_cast<size_t>(std::min<uint64_t>(size, 2048)), '\0');
+    bool ok = std::fseek(f, static_cast<long>(size - tail.size()), SEEK_SET) == 0 &&
+              std::fread(&tail[0], 1, tail.size(), f) == tail.size();
+    char head[4] = {};
+    ok = ok && parse_pdf_startxref(tail, size, startxref) &&
+         std::fseek(f, static_cast<long>(startxref), SEEK_SET) == 0 &&
+         std::fread(head, 1, 4, f) == 4;
+    xref_stream = std::memcmp(head, "xref", 4) != 0;
+    std::fclose(f);
+    return ok;
+}
+
+static bool read_pdf_tail(const uint8_t* data, uint64_t size, uint64_t& startxref, bool& xref_stream) {
+    size_t n = static_cast<size_t>(std::min<uint64_t>(size, 2048));
+    std::string tail(reinterpret_cast<const char*>(data + size - n), n);
+    if (!parse_pdf_startxref(tail, size, startxref) || size - startxref < 4) return false;
+    xref_stream = std::memcmp(data + startxref, "xref", 4) != 0;
+    return true;
+}
+
+static std::string pdf_xref_table(const std::vector<std::pair<int, uint64_t>>& entries,
+                                  const std::vector<PdfUpdateObject>& objs) {
+    std::string out = "xref\n";
+    char line[32];
+    for (size_t i = 0; i < entries.size();) {
+        size_t j = i + 1;
+        while (j < entries.size() && entries[j].first == entries[j - 1].first + 1) j++;
+        out += std::to_string(entries[i].first) + " " + std::to_string(j - i) + "\n";
+        for (size_t k = i; k < j; k++) {
+            int gen = 0;
+            for (auto& o : objs) if (o.num == entries[k].first) gen = o.gen;
+            std::snprintf(line, sizeof line, "%010" PRIu64 " %05d n\r\n", entries[k].second, gen);
+            out += line;
+        }
+        i = j;
+    }
+    return out;
+}
+
+// Builds the bytes to append to a file of `base` bytes, or returns
+// false when the document has nothing to remove
+static bool build_pdf_update(QPDF& pdf, uint64_t base, uint64_t prev, bool xref_stream,
+                             std::string& update) {
+    QPDFObjectHandle trailer = pdf.getTrailer();
+    QPDFObjectHandle root = pdf.getRoot();
+    QPDFObjectHandle info = trailer.getKey("/Info");
+    QPDFObjectHandle meta = root.getKey("/Metadata");
+    bool has_info = !info.isNull();
+    bool has_meta = !meta.isNull();
+    if (!has_info && !has_meta) return false;
+
+    std::vector<PdfUpdateObject> objs;
+    if (has_meta) {
+        if (meta.isIndirect()) {
+            objs.push_back({meta.getObjectID(), meta.getGeneration(),
+                            "<< /Type /Metadata /Subtype /XML /Length 0 >>\nstream\n\nendstream"});
+        }
+        root.removeKey("/Metadata");
+        objs.push_back({root.getObjectID(), root.getGeneration(), root.unparseResolved()});
+    }
+    if (has_info && info.isIndirect()) {
+        objs.push_back({info.getObjectID(), info.getGeneration(), "<< >>"});
+    }
+    std::sort(objs.begin(), objs.end(),
+              [](const PdfUpdateObject& a, const PdfUpdateObject& b) { return a.num < b.num; });
+
+    long long size = trailer.getKey("/Size").getIntValue();
+    std::string common = " /Root " + root.unparse() + " /Prev " + std::to_string(prev);
+    if (trailer.hasKey("/ID")) common += " /ID " + trailer.getKey("/ID").unparse();
+
+    update = "\n";
+    std::vector<std::pair<int, uint64_t>> entries;
+    for (auto& o : objs) {
+        entries.push_back({o.num, base + update.size()});
+        update += std::to_string(o.num) + " " + std::to_string(o.gen) + " obj\n" + o.body + "\nendobj\n";
+        size = std::max<long long>(size, o.num + 1);
+    }
+    uint64_t xref_at = base + update.size();
+
+    if (!xref_stream) {
+        update += pdf_xref_table(entries, objs);
+        update += "trailer\n<< /Size " + std::to_string(size) + common + " >>\n";
+    } else {
+        // The xref stream is itself a new object and lists its own entry
+        int self = static_cast<int>(size);
+        entries.push_back({self, xref_at});
+        objs.push_back({self, 0, ""});
+        int w = (xref_at >> 32) ? 8 : 4;
+        std::string data, index;
+        for (size_t i = 0; i < entries.size();) {
+            size_t j = i + 1;
+            while (j < entries.size() && entries[j].first == entries[j - 1].first + 1) j++;
+            index += std::to_string(entries[i].first) + " " + std::to_string(j - i) + " ";
+            i = j;
+        }
+        for (auto& e : entries) {
+            int gen = 0;
+            for (auto& o : objs) if (o.num == e.first) gen = o.gen;
+            data += '\x01';
+            for (int b = w - 1; b >= 0; b--) data += static_cast<char>((e.second >> (8 * b)) & 0xFF);
+            data += static_cast<char>((gen >> 8) & 0xFF);
+            data += static_cast<char>(gen & 0xFF);
+        }
+        index.pop_back();
+        update += std::to_string(self) + " 0 obj\n<< /Type /XRef /Size " + std::to_string(self + 1) +
+                  " /W [1 " + std::to_string(w) + " 2] /Index [" + index + "]" + common +
+                  " /Length " + std::to_string(data.size()) + " >>\nstream\n" + data +
+                  "\nendstream\nendobj\n";
+    }
+    update += "startxref\n" + std::to_string(xref_at) + "\n%%EOF\n";
+    return true;
+}
+
+static void append_bytes(const fs::path& p, const std::string& bytes) {
+    int fd = ::open(p.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+    const char* s = bytes.data();
+    size_t n = bytes.size();
+    while (n > 0) {
+        ssize_t k = ::write(fd, s, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "append " + p.string());
+        }
+        s += k;
+        n -= static_cast<size_t>(k);
+    }
+    ::close(fd);
+}
+
+// Writes `in` plus the update to `target`, which may be `in` itself.
+// Returns false without writing when incremental is unsuitable:
+// encrypted documents, or ones qpdf had to repair.
+static bool clean_pdf_incremental(const fs::path& in, const fs::path& target) {
+    uint64_t base = fs::file_size(in);
+    uint64_t prev = 0;
+    bool xref_stream = false;
+    if (!read_pdf_tail(in, base, prev, xref_stream)) return false;
+
+    std::string update;
+    bool changed;
+    {
+        TraceSpan span("pdf.parse");
+        QPDF pdf;
+        pdf.setSuppressWarnings(true);
+        pdf.processFile(in.c_str());
+        if (pdf.isEncrypted() || !pdf.getWarnings().empty()) return false;
+        changed = build_pdf_update(pdf, base, prev, xref_stream, update);
+    }
+    TraceSpan span("pdf.append");
+
+    if (target == in && !changed) return true;
+
+    // The update goes onto a temp copy that is renamed into place, so
+    // an in-place clean never leaves a half-appended original. The
+    // copy is a reflink where the filesystem allows and an in-kernel
+    // copy elsewhere.
+    fs::path tmp = temp_path_for(target);
+    try {
+        copy_file_fast(in, tmp);
+        if (changed) append_bytes(tmp, update);
+        fs::rename(tmp, target);
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+    return true;
+}
+
+// Cleans `in` into `target` (which may be `in` itself) via a temp file
+// beside the target, so a failure never leaves a partial output.
+// PdfMode::incremental appends instead and falls back to a full
+// rewrite (mode preserve) when the document can't take an update.
+static PdfResult clean_pdf_file(const fs::path& in, const fs::path& target, PdfMode mode) {
+    PdfResult res;
+    res.mode = mode;
+    if (mode == PdfMode::incremental) {
+        try {
+            if (clean_pdf_incremental(in, target)) return res;
+        } catch (const QPDFExc& e) {
+            res.error = pdf_error_from(e);
+            return res;
+        } catch (const std::exception& e) {
+            res.error = {PdfError::write_failed, e.what()};
+            return res;
+        }
+        res.mode = PdfMode::preserve;
+    }
+
+    fs::path tmp = temp_path_for(target);
+    PdfError& err = res.error;
+    try {
+        QPDF pdf;
+        {
+            TraceSpan span("pdf.parse");
+            pdf.setSuppressWarnings(true);
+            pdf.processFile(in.c_str());
+            strip_pdf_metadata(pdf);
+        }
+
+        TraceSpan span("pdf.write");
+        QPDFWriter w(pdf, tmp.c_str());
+        configure_writer(w, res.mode);
+        w.write();
+        res.warnings = pdf.getWarnings().size();
+    } catch (const QPDFExc& e) {
+        err = pdf_error_from(e);
+    } catch (const std::system_error& e) {
+        err = {PdfError::write_failed, e.what()};
+    } catch (const std::exception& e) {
+        err = {PdfError::internal, e.what()};
+    }
+
+    std::error_code ec;
+    if (err) {
+        fs::remove(tmp, ec);
+        return res;
+    }
+    fs::permissions(tmp, fs::status(in, ec).permissions(), ec);
+    fs::rename(tmp, target, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        err = {PdfError::write_failed, "rename to " + target.string() + ": " + ec.message()};
+    }
+    return res;
+}
+
+// -------------------------------------------------------------
+// Cleaning from memory
+//
+// The same modes as clean_pdf_file, for a document already in
+// memory, written to a ByteSink as QPDFWriter produces it. An
+// incremental update passes the input through and appends to it.
+// A failure part way through can leave partial output in the sink.
+// -------------------------------------------------------------
+class SinkPipeline : public Pipeline {
+public:
+    explicit SinkPipeline(ByteSink& sink) : Pipeline("cleanmeta sink", nullptr), sink_(sink) {}
+    void write(unsigned char const* data, size_t n) override { sink_.write(data, n); }
+    void finish() override {}
+
+private:
+    ByteSink& sink_;
+};
+
+static PdfResult clean_pdf_buffer(const uint8_t* data, size_t size, ByteSink& sink, PdfMode mode) {
+    PdfResult res;
+    res.mode = mode;
+    PdfError& err = res.error;
+    const char* bytes = reinterpret_cast<const char*>(data);
+    try {
+        uint64_t prev = 0;
+        bool xref_stream = false;
+        if (mode == PdfMode::incremental && read_pdf_tail(data, size, prev, xref_stream)) {
+            std::string update;
+            bool usable;
+            bool changed = false;
+            {
+                TraceSpan span("pdf.parse");
+                QPDF pdf;
+                pdf.setSuppressWarnings(true);
+                pdf.processMemoryFile("buffer", bytes, size);
+                usable = !pdf.isEncrypted() && pdf.getWarnings().empty();
+                if (usable) changed = build_pdf_update(pdf, size, prev, xref_stream, update);
+            }
+            if (usable) {
+                TraceSpan span("pdf.append");
+                sink.write(data, size);
+                if (changed) sink.write(update.data(), update.size());
+                return res;
+            }
+        }
+        if (mode == PdfMode::incremental) res.mode = PdfMode::preserve;
+
+        QPDF pdf;
+        {
+            TraceSpan span("pdf.parse");
+            pdf.setSuppressWarnings(true);
+            pdf.processMemoryFile("buffer", bytes, size);
+            strip_pdf_metadata(pdf);
+        }
+
+        TraceSpan span("pdf.write");
+        SinkPipeline pipe(sink);
+        QPDFWriter w(pdf);
+        w.setOutputPipeline(&pipe);
+        configure_writer(w, res.mode);
+        w.write();
+        res.warnings = pdf.getWarnings().size();
+    } catch (const QPDFExc& e) {
+        err = pdf_error_from(e);
+    } catch (const std::system_error& e) {
+        err = {PdfError::write_failed, e.what()};
+    } catch (const std::exception& e) {
+        err = {PdfError::internal, e.what()};
+    }
+    return res;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#include "exif_filter.h"
+#include "file_io.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Streaming PNG chunk filter
+//
+// Critical chunks (IHDR, PLTE, IDAT, IEND) and the allow-listed
+// ancillary chunks below are copied through byte for byte, CRC
+// included; IDAT is never inflated. Everything else — tEXt, zTXt,
+// iTXt, eXIf, tIME and unknown private chunks — is dropped, as is
+// anything after IEND. Memory use is the I/O buffer, whatever the
+// chunk sizes. When the policy keeps Exif tags, eXIf is rebuilt
+// with just those (and a new CRC) instead of dropped.
+// -------------------------------------------------------------
+static const char* const kPngKeepChunks[] = {
+    "tRNS", "gAMA", "cHRM", "sRGB", "iCCP", "sBIT", "bKGD", "hIST",
+    "pHYs", "sPLT", "cICP", "mDCv", "cLLi", "acTL", "fcTL", "fdAT",
+};
+
+static const uint8_t kPngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+// Larger eXIf chunks are dropped whole rather than read into memory
+static const uint32_t kPngMaxExif = 1u << 20;
+
+static uint32_t png_crc_update(uint32_t crc, const uint8_t* p, size_t n) {
+    static const struct Table {
+        uint32_t v[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
+    } table;
+    for (size_t i = 0; i < n; i++) crc = table.v[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void png_put_be32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+static bool png_keeps_chunk(const uint8_t type[4]) {
+    if ((type[0] & 0x20) == 0) return true;  // critical
+    for (const char* keep : kPngKeepChunks) {
+        if (std::memcmp(type, keep, 4) == 0) return true;
+    }
+    return false;
+}
+
+// Returns false when the input is not a well-formed PNG chunk stream;
+// the caller then falls back to Exiv2.
+static bool strip_png(InFile& in, OutFile& out, const KeepPolicy& keep, StripStats& st) {
+    uint8_t sig[8];
+    if (!in.read(sig, 8) || std::memcmp(sig, kPngSignature, 8) != 0) return false;
+    out.write(sig, 8);
+
+    for (;;) {
+        uint8_t hdr[8];
+        if (!in.read(hdr, 8)) return false;  // missing IEND
+        uint32_t len = (uint32_t(hdr[0]) << 24) | (uint32_t(hdr[1]) << 16) |
+                       (uint32_t(hdr[2]) << 8) | uint32_t(hdr[3]);
+        if (len > 0x7FFFFFFFu) return false;
+        const uint8_t* type = hdr + 4;
+        for (int i = 0; i < 4; i++) {
+            if (!std::isalpha(type[i])) return false;
+        }
+        uint64_t body = uint64_t(len) + 4;  // data + CRC
+
+        if (keep.keeps_exif && std::memcmp(type, "eXIf", 4) == 0 && len <= kPngMaxExif) {
+            std::vector<uint8_t> data(body), kept;
+            if (!in.read(data.data(), data.size())) return false;
+            filter_exif(data.data(), len, keep, kept);
+            if (!kept.empty()) {
+                uint8_t b[4];
+                png_put_be32(b, static_cast<uint32_t>(kept.size()));
+                out.write(b, 4);
+                out.write(type, 4);
+                out.write(kept.data(), kept.size());
+                png_put_be32(b, png_crc_update(png_crc_update(0xFFFFFFFFu, type, 4), kept.data(), kept.size()) ^
+                                    0xFFFFFFFFu);
+                out.write(b, 4);
+                st.bytes_removed += len - kept.size();
+                continue;
+            }
+            st.segments_removed++;
+            st.bytes_removed += 8 + body;
+            continue;
+        }
+
+        if (!png_keeps_chunk(type)) {
+            if (!in.skip(body)) return false;
+            st.segments_removed++;
+            st.bytes_removed += 8 + body;
+            continue;
+        }
+
+        out.write(hdr, 8);
+        if (in.copy_to(out, body) != body) return false;
+
+        if (std::memcmp(type, "IEND", 4) == 0) {
+            // Trailing bytes after IEND are not part of the image
+            st.bytes_removed += in.skip_all();
+            return true;
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// In-place PNG scrub
+//
+// Each chunk strip_png would drop is renamed to kPngPadType — a
+// private, ancillary, safe-to-copy type that decoders skip — its
+// data zeroed and its CRC recomputed. Bytes after IEND are zeroed.
+// Only the chunk headers are read; IDAT is never touched.
+// -------------------------------------------------------------
+static const uint8_t kPngPadType[4] = {'s', 'c', 'R', 'b'};
+
+// CRC of the pad type followed by `len` zero bytes
+static uint32_t png_pad_crc(uint32_t len) {
+    static const uint8_t kZeros[4096] = {};
+    uint32_t crc = png_crc_update(0xFFFFFFFFu, kPngPadType, 4);
+    while (len > 0) {
+        uint32_t k = std::min<uint32_t>(len, sizeof kZeros);
+        crc = png_crc_update(crc, kZeros, k);
+        len -= k;
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static bool scrub_png(const PatchFile& f, ScrubPlan& plan, StripStats& st) {
+    uint8_t sig[8];
+    if (!f.read_at(0, sig, 8) || std::memcmp(sig, kPngSignature, 8) != 0) return false;
+
+    uint64_t at = 8;
+    for (;;) {
+        uint8_t hdr[8];
+        if (!f.read_at(at, hdr, 8)) return false;  // missing IEND
+        uint32_t len = (uint32_t(hdr[0]) << 24) | (uint32_t(hdr[1]) << 16) |
+                       (uint32_t(hdr[2]) << 8) | uint32_t(hdr[3]);
+        if (len > 0x7FFFFFFFu) return false;
+        const uint8_t* type = hdr + 4;
+        for (int i = 0; i < 4; i++) {
+            if (!std::isalpha(type[i])) return false;
+        }
+        uint64_t end = at + 12 + len;
+        if (end > f.size()) return false;
+
+        if (!png_keeps_chunk(type) && std::memcmp(type, kPngPadType, 4) != 0) {
+            uint32_t crc = png_pad_crc(len);
+            uint8_t crc_be[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+            plan.zero(at + 8, len);
+            plan.write(at + 4, kPngPadType, 4);
+            plan.write(at + 8 + len, crc_be, 4);
+            st.segments_removed++;
+        }
+        at = end;
+
+        if (std::memcmp(type, "IEND", 4) == 0) {
+            plan.zero(at, f.size() - at);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// -------------------------------------------------------------
+// Daemon protocol (--serve / --connect)
+//
+// A Unix stream socket. Each request is one line:
+//
+//     <id> TAB <op> TAB <options> TAB <argument> LF
+//
+// op "path" cleans the file named by the argument, which must be an
+// absolute path. op "fd" cleans from and to two descriptors that
+// travel with the line as SCM_RIGHTS (input first, then output); its
+// argument is only a label for the result. options are the CLI
+// flags without their dashes, comma-separated ("in-place,
+// pdf-mode=preserve"). Each response is one line of flat JSON that
+// carries the request's id.
+//
+// A client may send any number of requests before reading the
+// responses. Requests run in parallel on the daemon's pool, so
+// responses arrive in completion order, not request order.
+//
+// "path" requests open and rename files with the daemon's
+// credentials, so they are only taken from a peer running as the
+// daemon's own user (or root); anyone else the socket's mode lets in
+// can use "fd" requests, on descriptors they opened themselves.
+// -------------------------------------------------------------
+static const size_t kMaxRequestLine = 64 * 1024;
+static const int kMaxPassedFds = 16;
+
+// Buffered line reader over a socket that also collects the
+// descriptors passed along with the bytes, in arrival order
+class SocketReader {
+public:
+    explicit SocketReader(int fd) : fd_(fd) {}
+    ~SocketReader() {
+        for (int fd : fds_) ::close(fd);
+    }
+    SocketReader(const SocketReader&) = delete;
+    SocketReader& operator=(const SocketReader&) = delete;
+
+    // False at EOF, on error, or when a line exceeds kMaxRequestLine
+    bool read_line(std::string& line) {
+        for (;;) {
+            size_t nl = buf_.find('\n');
+            if (nl != std::string::npos) {
+                line.assign(buf_, 0, nl);
+                buf_.erase(0, nl + 1);
+                return true;
+            }
+            if (buf_.size() > kMaxRequestLine || !fill()) return false;
+        }
+    }
+
+    // The next passed descriptor, now owned by the caller; -1 if none
+    int take_fd() {
+        if (fds_.empty()) return -1;
+        int fd = fds_.front();
+        fds_.pop_front();
+        return fd;
+    }
+
+private:
+    bool fill() {
+        char data[16 * 1024];
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+        struct iovec iov = {data, sizeof data};
+        struct msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        ssize_t n;
+#ifdef MSG_CMSG_CLOEXEC
+        do { n = ::recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC); } while (n < 0 && errno == EINTR);
+#else
+        do { n = ::recvmsg(fd_, &msg, 0); } while (n < 0 && errno == EINTR);
+#endif
+        if (n <= 0) return false;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof fd);
+                fds_.push_back(fd);
+            }
+        }
+        buf_.append(data, static_cast<size_t>(n));
+        return true;
+    }
+
+    int fd_;
+    std::string buf_;
+    std::deque<int> fds_;
+};
+
+// Sends all of `s`, attaching `fds` to its first byte
+static void send_with_fds(int sock, const std::string& s, const int* fds = nullptr, int nfds = 0) {
+    size_t done = 0;
+    while (done < s.size()) {
+        struct iovec iov = {const_cast<char*>(s.data()) + done, s.size() - done};
+        struct msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+        if (done == 0 && nfds > 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+            struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+            std::memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+        }
+        ssize_t k = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "send");
+        done += static_cast<size_t>(k);
+    }
+}
+
+static int unix_socket(const std::string& path, struct sockaddr_un& addr) {
+    if (path.size() >= sizeof addr.sun_path) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    }
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+    return fd;
+}
+
+// Binds and listens on `path` with permissions `mode`, replacing a
+// stale socket left by a daemon that didn't shut down cleanly (but
+// never a regular file). The socket is created owner-only, so nobody
+// can connect before the chmod; call before starting any threads,
+// since the umask is process-wide.
+static int unix_listen(const std::string& path, mode_t mode) {
+    struct sockaddr_un addr;
+    int fd = unix_socket(path, addr);
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) ::unlink(path.c_str());
+    mode_t old_mask = ::umask(0177);
+    int rc = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr);
+    ::umask(old_mask);
+    if (rc != 0 || ::chmod(path.c_str(), mode) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "listen on " + path);
+    }
+    return fd;
+}
+
+// The user of the process at the other end of a connected socket
+static bool peer_uid(int fd, uid_t& uid) {
+#ifdef __APPLE__
+    gid_t gid;
+    return ::getpeereid(fd, &uid, &gid) == 0;
+#else
+    struct ucred cred {};
+    socklen_t len = sizeof cred;
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+    uid = cred.uid;
+    return true;
+#endif
+}
+
+static int unix_connect(const std::string& path) {
+    struct sockaddr_un addr;
+    int fd = unix_socket(path, addr);
+    int rc;
+    do { rc = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr); } while (rc != 0 && errno == EINTR);
+    if (rc != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "connect to " + path);
+    }
+    return fd;
+}
+
+// -------------------------------------------------------------
+// Flat JSON: one object of string, number and boolean members,
+// which is all a response holds
+// -------------------------------------------------------------
+static void json_append_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof esc, "\\u%04x", c);
+            out += esc;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+// Parses {"key": value, ...}; string values are unescaped, others
+// kept as written. False on anything else.
+static bool json_parse_flat(const std::string& s, std::map<std::string, std::string>& out) {
+    size_t i = 0;
+    auto ws = [&] { while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) i++; };
+    auto str = [&](std::string& v) {
+        if (i >= s.size() || s[i] != '"') return false;
+        for (i++; i < s.size() && s[i] != '"'; i++) {
+            if (s[i] != '\\') {
+                v += s[i];
+                continue;
+            }
+            if (++i >= s.size()) return false;
+            switch (s[i]) {
+                case 'n': v += '\n'; break;
+                case 't': v += '\t'; break;
+                case 'u':
+                    if (i + 4 >= s.size()) return false;
+                    v += static_cast<char>(std::strtoul(s.substr(i + 1, 4).c_str(), nullptr, 16));
+                    i += 4;
+                    break;
+                default: v += s[i]; break;
+            }
+        }
+        return i++ < s.size();
+    };
+    ws();
+    if (i >= s.size() || s[i++] != '{') return false;
+    for (;;) {
+        ws();
+        if (i < s.size() && s[i] == '}') return true;
+        std::string key, value;
+        if (!str(key)) return false;
+        ws();
+        if (i >= s.size() || s[i++] != ':') return false;
+        ws();
+        if (i < s.size() && s[i] == '"') {
+            if (!str(value)) return false;
+        } else {
+            while (i < s.size() && s[i] != ',' && s[i] != '}') value += s[i++];
+            while (!value.empty() && value.back() == ' ') value.pop_back();
+        }
+        out[key] = value;
+        ws();
+        if (i < s.size() && s[i] == ',') i++;
+    }
+}
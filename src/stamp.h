@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "file_io.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Clean stamps for incremental runs
+//
+// After a successful clean the output gets a `user.cleanmeta`
+// xattr recording the tool version, the policy hash and the size
+// and mtime of both the source and the output. A later run skips
+// a file when the stamp it would write matches the one present,
+// which costs a stat and a getxattr (plus a stat of the source in
+// copy mode) instead of opening the file.
+//
+// Filesystems without xattrs fall back to a per-directory sidecar
+// index, `.cleanmeta-index`, saved at the end of the run.
+// -------------------------------------------------------------
+static const char* const kStampAttr = "user.cleanmeta";
+
+struct FileIdentity {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+};
+
+static bool identify(const fs::path& p, FileIdentity& id) {
+    struct stat st {};
+    if (::stat(p.c_str(), &st) != 0) return false;
+    id.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    id.mtime_ns = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    id.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+static std::string make_stamp(uint64_t policy, const FileIdentity& src, const FileIdentity& out) {
+    char buf[160];
+    std::snprintf(buf, sizeof buf, "cleanmeta/%s policy=%016llx src=%llu:%lld out=%llu:%lld",
+                  CLEANMETA_VERSION, static_cast<unsigned long long>(policy),
+                  static_cast<unsigned long long>(src.size), static_cast<long long>(src.mtime_ns),
+                  static_cast<unsigned long long>(out.size), static_cast<long long>(out.mtime_ns));
+    return buf;
+}
+
+class StampIndex {
+public:
+    bool get(const fs::path& file, std::string& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Dir& d = load(file.parent_path());
+        auto it = d.entries.find(file.filename().string());
+        if (it == d.entries.end()) return false;
+        value = it->second;
+        return true;
+    }
+
+    void put(const fs::path& file, const std::string& value) {
+        std::string name = file.filename().string();
+        if (name.find_first_of("\t\n") != std::string::npos) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Dir& d = load(file.parent_path());
+        d.entries[name] = value;
+        d.dirty = true;
+    }
+
+    // Writes every index that changed, each via temp file + rename
+    void save() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [dir, d] : dirs_) {
+            if (!d.dirty) continue;
+            fs::path idx = dir / kStampIndexName;
+            fs::path tmp = idx;
+            tmp += ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                out << "cleanmeta-index 1\n";
+                for (auto& [name, value] : d.entries) out << name << '\t' << value << '\n';
+            }
+            std::error_code ec;
+            fs::rename(tmp, idx, ec);
+            d.dirty = false;
+        }
+    }
+
+private:
+    struct Dir {
+        std::map<std::string, std::string> entries;
+        bool dirty = false;
+    };
+
+    Dir& load(const fs::path& dir) {
+        auto it = dirs_.find(dir);
+        if (it != dirs_.end()) return it->second;
+        Dir& d = dirs_[dir];
+        std::ifstream in(dir / kStampIndexName);
+        std::string line;
+        if (std::getline(in, line) && line == "cleanmeta-index 1") {
+            while (std::getline(in, line)) {
+                size_t tab = line.find('\t');
+                if (tab != std::string::npos) d.entries[line.substr(0, tab)] = line.substr(tab + 1);
+            }
+        }
+        return d;
+    }
+
+    std::mutex mutex_;
+    std::map<fs::path, Dir> dirs_;
+};
+
+static StampIndex& stamp_index() {
+    static StampIndex index;
+    return index;
+}
+
+// Errors that mean `p` can't carry a user.* xattr at all, so its
+// stamp lives in the sidecar (EPERM: Linux refuses them on symlinks
+// and devices). Reader and writer must agree, or a stamp is written
+// where it is never looked for.
+static bool xattr_unsupported(int err) {
+    return err == ENOTSUP || err == EOPNOTSUPP || err == EPERM;
+}
+
+static bool read_stamp(const fs::path& p, std::string& value) {
+    char buf[256];
+#ifdef __APPLE__
+    ssize_t n = ::getxattr(p.c_str(), kStampAttr, buf, sizeof buf, 0, 0);
+#else
+    ssize_t n = ::getxattr(p.c_str(), kStampAttr, buf, sizeof buf);
+#endif
+    if (n >= 0) {
+        value.assign(buf, static_cast<size_t>(n));
+        return true;
+    }
+    // A file that simply has no stamp yet is the common case on a
+    // filesystem with xattrs
+    if (xattr_unsupported(errno)) return stamp_index().get(p, value);
+    return false;
+}
+
+static void write_stamp(const fs::path& p, const std::string& value) {
+#ifdef __APPLE__
+    int rc = ::setxattr(p.c_str(), kStampAttr, value.data(), value.size(), 0, 0);
+#else
+    int rc = ::setxattr(p.c_str(), kStampAttr, value.data(), value.size(), 0);
+#endif
+    // Other failures (ENOSPC, E2BIG, EACCES) leave the file unstamped;
+    // the next run cleans it again
+    if (rc != 0 && xattr_unsupported(errno)) stamp_index().put(p, value);
+}
+
+// True when `out` carries a stamp for the current source, output and policy
+static bool stamp_matches(const fs::path& src, const fs::path& out, uint64_t policy) {
+    TraceSpan span("stamp.check");
+    FileIdentity o;
+    if (!identify(out, o)) return false;
+    FileIdentity s = o;
+    if (src != out && !identify(src, s)) return false;
+    std::string have;
+    return read_stamp(out, have) && have == make_stamp(policy, s, o);
+}
+
+static void stamp_output(const fs::path& src, const fs::path& out, uint64_t policy) {
+    TraceSpan span("stamp.write");
+    FileIdentity o;
+    if (!identify(out, o)) return;
+    FileIdentity s = o;
+    if (src != out && !identify(src, s)) return;
+    write_stamp(out, make_stamp(policy, s, o));
+}
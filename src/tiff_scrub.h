@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "file_io.h"
+
+// -------------------------------------------------------------
+// In-place TIFF scrub
+//
+// There is no streaming TIFF rewriter (Exiv2 does that), but the
+// metadata in a TIFF is a handful of IFD entries, so it can be
+// scrubbed where it lies: along the IFD0 chain, each entry below is
+// retagged into the private range as a 4-byte UNDEFINED of zeros,
+// its out-of-line value is zeroed, and the entries are re-sorted so
+// the IFD stays in ascending tag order. The Exif and GPS IFDs the
+// pointer tags lead to, and everything they reference (MakerNote,
+// the Interop IFD), are zeroed with them. Strip and tile data are
+// never read. Classic TIFF only; BigTIFF falls back to a rewrite.
+// -------------------------------------------------------------
+static const uint16_t kTiffScrubTags[] = {
+    0x010D,  // DocumentName
+    0x010E,  // ImageDescription
+    0x010F,  // Make
+    0x0110,  // Model
+    0x0131,  // Software
+    0x0132,  // DateTime
+    0x013B,  // Artist
+    0x013C,  // HostComputer
+    0x02BC,  // XMP
+    0x8298,  // Copyright
+    0x83BB,  // IPTC
+    0x8649,  // Photoshop image resources
+    0x8769,  // Exif IFD
+    0x8825,  // GPS IFD
+    0x9C9B, 0x9C9C, 0x9C9D, 0x9C9E, 0x9C9F,  // Windows XP title/comment/author/keywords/subject
+};
+
+static const uint16_t kTiffPadTag = 65000;  // start of the reusable private range
+static const uint16_t kTiffUndefined = 7;
+static const int kTiffMaxIfds = 256;
+static const int kTiffMaxDepth = 4;
+
+struct TiffWalker {
+    const PatchFile& f;
+    ScrubPlan& plan;
+    bool le;
+    int ifds = 0;
+
+    uint16_t u16(const uint8_t* p) const {
+        return le ? uint16_t(p[0] | (p[1] << 8)) : uint16_t((p[0] << 8) | p[1]);
+    }
+    uint32_t u32(const uint8_t* p) const {
+        return le ? uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24)
+                  : (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    void put16(uint8_t* p, uint16_t v) const {
+        if (le) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+        else { p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); }
+    }
+    void put32(uint8_t* p, uint32_t v) const {
+        for (int i = 0; i < 4; i++) p[le ? i : 3 - i] = uint8_t(v >> (8 * i));
+    }
+
+    // Reads the IFD at `off` into `entries` (12 bytes each); false
+    // when it runs past the end of the file or too many were seen
+    bool read_ifd(uint32_t off, std::vector<uint8_t>& entries, uint32_t& next) {
+        uint8_t count_b[2];
+        if (++ifds > kTiffMaxIfds || !f.read_at(off, count_b, 2)) return false;
+        entries.resize(size_t(u16(count_b)) * 12);
+        uint8_t next_b[4];
+        if (!f.read_at(off + 2, entries.data(), entries.size()) ||
+            !f.read_at(off + 2 + entries.size(), next_b, 4)) return false;
+        next = u32(next_b);
+        return true;
+    }
+
+    // Out-of-line extent of an entry's value; size 0 when it is inline
+    bool value_extent(const uint8_t* e, uint64_t& off, uint64_t& size) const {
+        static const uint8_t kTypeSize[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4};
+        uint16_t type = u16(e + 2);
+        uint64_t unit = type < sizeof kTypeSize ? kTypeSize[type] : 1;
+        size = unit * u32(e + 4);
+        off = u32(e + 8);
+        if (size <= 4) {
+            size = 0;
+            return true;
+        }
+        return off <= f.size() && size <= f.size() - off;
+    }
+
+    // Zeroes a sub-IFD, its out-of-line values and the IFDs it points to
+    bool zero_ifd(uint32_t off, int depth) {
+        std::vector<uint8_t> entries;
+        uint32_t next;
+        if (depth > kTiffMaxDepth || !read_ifd(off, entries, next)) return false;
+        for (size_t i = 0; i < entries.size(); i += 12) {
+            const uint8_t* e = entries.data() + i;
+            uint64_t voff, vsize;
+            if (!value_extent(e, voff, vsize)) return false;
+            plan.zero(voff, vsize);
+            uint16_t tag = u16(e);
+            if (tag == 0x8769 || tag == 0x8825 || tag == 0xA005) {  // Exif, GPS, Interop
+                if (!zero_ifd(u32(e + 8), depth + 1)) return false;
+            }
+        }
+        plan.zero(off, 2 + entries.size() + 4);
+        return true;
+    }
+
+    // Scrubs one IFD of the main chain and returns the offset of the next
+    bool scrub_ifd(uint32_t off, uint32_t& next, StripStats& st) {
+        std::vector<uint8_t> entries;
+        if (!read_ifd(off, entries, next)) return false;
+        uint16_t pad = kTiffPadTag;
+        bool changed = false;
+        for (size_t i = 0; i < entries.size(); i += 12) {
+            uint8_t* e = entries.data() + i;
+            uint16_t tag = u16(e);
+            if (std::find(std::begin(kTiffScrubTags), std::end(kTiffScrubTags), tag) ==
+                std::end(kTiffScrubTags)) continue;
+            uint64_t voff, vsize;
+            if (!value_extent(e, voff, vsize)) return false;
+            plan.zero(voff, vsize);
+            if ((tag == 0x8769 || tag == 0x8825) && !zero_ifd(u32(e + 8), 1)) return false;
+            put16(e, pad++);
+            put16(e + 2, kTiffUndefined);
+            put32(e + 4, 4);
+            std::memset(e + 8, 0, 4);
+            st.segments_removed++;
+            changed = true;
+        }
+        if (!changed) return true;
+
+        std::vector<std::array<uint8_t, 12>> sorted(entries.size() / 12);
+        for (size_t i = 0; i < sorted.size(); i++) std::memcpy(sorted[i].data(), &entries[i * 12], 12);
+        std::stable_sort(sorted.begin(), sorted.end(), [&](const auto& a, const auto& b) {
+            return u16(a.data()) < u16(b.data());
+        });
+        for (size_t i = 0; i < sorted.size(); i++) std::memcpy(&entries[i * 12], sorted[i].data(), 12);
+        plan.write(off + 2, entries.data(), entries.size());
+        return true;
+    }
+};
+
+static bool scrub_tiff(const PatchFile& f, ScrubPlan& plan, StripStats& st) {
+    uint8_t hdr[8];
+    if (!f.read_at(0, hdr, sizeof hdr)) return false;
+    bool le;
+    if (std::memcmp(hdr, "II*\0", 4) == 0) le = true;
+    else if (std::memcmp(hdr, "MM\0*", 4) == 0) le = false;
+    else return false;  // BigTIFF or not a TIFF
+
+    TiffWalker w{f, plan, le};
+    uint32_t ifd = w.u32(hdr + 4);
+    while (ifd != 0) {
+        uint32_t next;
+        if (!w.scrub_ifd(ifd, next, st)) return false;
+        ifd = next;
+    }
+    return true;
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// -------------------------------------------------------------
+// Per-stage tracing and statistics
+//
+// TraceSpan marks one stage of one file ("strip", "exiv2.read",
+// "pdf.write", ...). Spans go into a buffer owned by the calling
+// thread, so recording takes no lock; the buffers are merged once,
+// at exit, into Chrome trace-event JSON (loads in Perfetto and
+// chrome://tracing) and/or per-format, per-stage histograms.
+//
+// Both switches are plain flags set before any worker starts; with
+// them off a span is a single predictable branch. The functions are
+// inline rather than static so the library and the executable share
+// one configuration and one set of buffers.
+// -------------------------------------------------------------
+struct TraceConfig {
+    bool events = false;  // --trace: keep every span
+    bool stats = false;   // --stats: histograms and byte counters
+};
+
+inline TraceConfig& trace_config() {
+    static TraceConfig config;
+    return config;
+}
+
+inline bool trace_enabled() {
+    const TraceConfig& c = trace_config();
+    return c.events || c.stats;
+}
+
+inline uint64_t trace_now_ns() {
+    using namespace std::chrono;
+    static const steady_clock::time_point origin = steady_clock::now();
+    return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - origin).count());
+}
+
+// Log-linear buckets: 4 per power of two of nanoseconds, so a
+// percentile read from them is within 19% of the true value
+static const int kHistBuckets = 64 * 4;
+
+inline int hist_bucket(uint64_t ns) {
+    if (ns < 4) return static_cast<int>(ns);
+    int log2 = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>((ns >> (log2 - 2)) & 3);
+    return std::min(kHistBuckets - 1, log2 * 4 + sub);
+}
+
+inline uint64_t hist_bucket_upper(int b) {
+    if (b < 4) return static_cast<uint64_t>(b);
+    int log2 = b / 4;
+    uint64_t base = uint64_t(1) << log2;
+    return base + (base >> 2) * static_cast<uint64_t>(b % 4 + 1);
+}
+
+struct StageHistogram {
+    const char* format = nullptr;
+    const char* stage = nullptr;
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint32_t buckets[kHistBuckets] = {};
+
+    void add(uint64_t ns) {
+        count++;
+        total_ns += ns;
+        max_ns = std::max(max_ns, ns);
+        buckets[hist_bucket(ns)]++;
+    }
+
+    void merge(const StageHistogram& o) {
+        count += o.count;
+        total_ns += o.total_ns;
+        max_ns = std::max(max_ns, o.max_ns);
+        for (int i = 0; i < kHistBuckets; i++) buckets[i] += o.buckets[i];
+    }
+
+    uint64_t percentile(double q) const {
+        uint64_t want = static_cast<uint64_t>(q * static_cast<double>(count));
+        uint64_t seen = 0;
+        for (int i = 0; i < kHistBuckets; i++) {
+            seen += buckets[i];
+            if (seen > want) return std::min(hist_bucket_upper(i), max_ns);
+        }
+        return max_ns;
+    }
+};
+
+struct FormatBytes {
+    const char* format = nullptr;
+    uint64_t files = 0;
+    uint64_t read = 0;
+    uint64_t written = 0;
+};
+
+struct TraceEvent {
+    const char* name;
+    const char* format;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    std::string detail;  // file path, only on the per-file span
+};
+
+struct TraceBuffer {
+    uint32_t tid = 0;
+    const char* format = "-";  // format of the file being processed, "-" outside one
+    std::vector<TraceEvent> events;
+    std::vector<StageHistogram> stages;
+    std::vector<FormatBytes> bytes;
+
+    // Formats and stages are string literals, so pointer equality is
+    // the common case; strcmp covers literals duplicated across TUs
+    static bool same(const char* a, const char* b) { return a == b || std::strcmp(a, b) == 0; }
+
+    StageHistogram& stage(const char* fmt, const char* name) {
+        for (auto& h : stages) {
+            if (same(h.format, fmt) && same(h.stage, name)) return h;
+        }
+        stages.emplace_back();
+        stages.back().format = fmt;
+        stages.back().stage = name;
+        return stages.back();
+    }
+
+    FormatBytes& format_bytes(const char* fmt) {
+        for (auto& b : bytes) {
+            if (same(b.format, fmt)) return b;
+        }
+        bytes.push_back({fmt, 0, 0, 0});
+        return bytes.back();
+    }
+};
+
+class TraceRegistry {
+public:
+    TraceBuffer& local() {
+        static thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::make_unique<TraceBuffer>());
+            buffer = buffers_.back().get();
+            buffer->tid = static_cast<uint32_t>(buffers_.size());
+        }
+        return *buffer;
+    }
+
+    // Only called once the workers have stopped
+    const std::vector<std::unique_ptr<TraceBuffer>>& buffers() const { return buffers_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+};
+
+inline TraceRegistry& trace_registry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+inline void trace_record(const char* name, uint64_t start_ns, std::string detail = {}) {
+    uint64_t dur = trace_now_ns() - start_ns;
+    TraceBuffer& b = trace_registry().local();
+    if (trace_config().stats) b.stage(b.format, name).add(dur);
+    if (trace_config().events) b.events.push_back({name, b.format, start_ns, dur, std::move(detail)});
+}
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name_(name) {
+        if (trace_enabled()) start_ = trace_now_ns();
+    }
+    ~TraceSpan() {
+        if (start_ != kOff) trace_record(name_, start_);
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    static constexpr uint64_t kOff = UINT64_MAX;
+    const char* name_;
+    uint64_t start_ = kOff;
+};
+
+// Scope of one file: sets the format the stage spans inside it are
+// filed under and records a "file" span carrying the path
+class TraceFile {
+public:
+    template <class Path>
+    TraceFile(const char* format, const Path& path) {
+        if (!trace_enabled()) return;
+        start_ = trace_now_ns();
+        trace_registry().local().format = format;
+        if (trace_config().events) path_ = path.string();
+    }
+    // Refiles the rest of this file's spans, e.g. once the format
+    // has been sniffed
+    void set_format(const char* format) {
+        if (start_ != kOff) trace_registry().local().format = format;
+    }
+    ~TraceFile() {
+        if (start_ == kOff) return;
+        trace_record("file", start_, std::move(path_));
+        trace_registry().local().format = "-";
+    }
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+private:
+    static constexpr uint64_t kOff = UINT64_MAX;
+    uint64_t start_ = kOff;
+    std::string path_;
+};
+
+// Files the calling thread's next spans under `format`, as
+// TraceFile::set_format does, for code that doesn't own the TraceFile
+inline void trace_set_format(const char* format) {
+    if (trace_enabled()) trace_registry().local().format = format;
+}
+
+inline void trace_bytes(uint64_t read, uint64_t written) {
+    if (!trace_config().stats) return;
+    TraceBuffer& b = trace_registry().local();
+    FormatBytes& f = b.format_bytes(b.format);
+    f.files++;
+    f.read += read;
+    f.written += written;
+}
+
+// -------------------------------------------------------------
+// Output
+// -------------------------------------------------------------
+inline void json_escape(std::FILE* f, const std::string& s) {
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') std::fprintf(f, "\\%c", c);
+        else if (c < 0x20) std::fprintf(f, "\\u%04x", c);
+        else std::fputc(c, f);
+    }
+}
+
+inline bool write_trace_json(const std::string& path) {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (auto& b : trace_registry().buffers()) {
+        std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                        "\"args\":{\"name\":\"worker %u\"}}",
+                     first ? "" : ",\n", b->tid, b->tid);
+        first = false;
+        for (auto& e : b->events) {
+            std::fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"dur\":%.3f",
+                         e.name, e.format, b->tid, e.start_ns / 1e3, e.dur_ns / 1e3);
+            if (!e.detail.empty()) {
+                std::fprintf(f, ",\"args\":{\"path\":\"");
+                json_escape(f, e.detail);
+                std::fprintf(f, "\"}");
+            }
+            std::fprintf(f, "}");
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+    return std::fclose(f) == 0;
+}
+
+inline void print_trace_stats(std::FILE* f) {
+    std::vector<StageHistogram> stages;
+    std::vector<FormatBytes> bytes;
+    for (auto& b : trace_registry().buffers()) {
+        for (auto& h : b->stages) {
+            auto it = std::find_if(stages.begin(), stages.end(), [&](const StageHistogram& s) {
+                return TraceBuffer::same(s.format, h.format) && TraceBuffer::same(s.stage, h.stage);
+            });
+            if (it == stages.end()) stages.push_back(h);
+            else it->merge(h);
+        }
+        for (auto& x : b->bytes) {
+            auto it = std::find_if(bytes.begin(), bytes.end(), [&](const FormatBytes& y) {
+                return TraceBuffer::same(y.format, x.format);
+            });
+            if (it == bytes.end()) {
+                bytes.push_back(x);
+            } else {
+                it->files += x.files;
+                it->read += x.read;
+                it->written += x.written;
+            }
+        }
+    }
+    std::sort(stages.begin(), stages.end(), [](const StageHistogram& a, const StageHistogram& b) {
+        int c = std::strcmp(a.format, b.format);
+        return c != 0 ? c < 0 : std::strcmp(a.stage, b.stage) < 0;
+    });
+
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    std::fprintf(f, "\nStage latency (ms)\n%-8s %-16s %8s %9s %9s %9s %9s %10s\n",
+                 "format", "stage", "count", "p50", "p90", "p99", "max", "total");
+    for (auto& h : stages) {
+        std::fprintf(f, "%-8s %-16s %8llu %9.3f %9.3f %9.3f %9.3f %10.1f\n", h.format, h.stage,
+                     static_cast<unsigned long long>(h.count), ms(h.percentile(0.50)),
+                     ms(h.percentile(0.90)), ms(h.percentile(0.99)), ms(h.max_ns), ms(h.total_ns));
+    }
+    if (bytes.empty()) return;
+    std::fprintf(f, "\nBytes\n%-8s %8s %14s %14s\n", "format", "files", "read", "written");
+    for (auto& b : bytes) {
+        std::fprintf(f, "%-8s %8llu %14llu %14llu\n", b.format,
+                     static_cast<unsigned long long>(b.files), static_cast<unsigned long long>(b.read),
+                     static_cast<unsigned long long>(b.written));
+    }
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CLEANMETA_HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// -------------------------------------------------------------
+// io_uring, straight from the syscalls (--io uring)
+//
+// Only the submission and completion queues are needed here, so
+// the ring is set up through io_uring_setup/enter/register itself
+// instead of adding liburing as a dependency. init() fails wherever
+// the kernel refuses a ring: before 5.6, when io_uring_disabled is
+// set, or when seccomp denies it (many container runtimes). The
+// caller then keeps to plain syscalls.
+//
+// One Uring belongs to one thread. sqe() hands out zeroed entries
+// and submit() sends every entry queued since the last call in a
+// single syscall.
+// -------------------------------------------------------------
+#ifdef CLEANMETA_HAVE_URING
+
+class Uring {
+public:
+    Uring() = default;
+    ~Uring() {
+        if (sq_map_ && sq_map_ != MAP_FAILED) ::munmap(sq_map_, sq_map_size_);
+        if (cq_map_ && cq_map_ != sq_map_ && cq_map_ != MAP_FAILED) ::munmap(cq_map_, cq_map_size_);
+        if (sqes_ && sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // False when the kernel has no usable io_uring
+    bool init(unsigned entries) {
+        // Completions are only reaped by the owning thread, inside
+        // submit(), so their task work can wait until then (6.1+);
+        // older kernels reject the flags and get a plain ring
+        struct io_uring_params p {};
+#if defined(IORING_SETUP_DEFER_TASKRUN)
+        p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                  IORING_SETUP_DEFER_TASKRUN;
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0 && errno == EINVAL) p = {};
+#endif
+        if (fd_ < 0) fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0) return false;
+
+        sq_map_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_map_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+        sq_map_ = ::mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                         IORING_OFF_SQ_RING);
+        if (sq_map_ == MAP_FAILED) return false;
+        cq_map_ = single ? sq_map_
+                         : ::mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  fd_, IORING_OFF_CQ_RING);
+        if (cq_map_ == MAP_FAILED) return false;
+        sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                         MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) return false;
+
+        auto* sq = static_cast<uint8_t*>(sq_map_);
+        sq_head_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+        sq_entries_ = p.sq_entries;
+        auto* cq = static_cast<uint8_t*>(cq_map_);
+        cq_head_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+        tail_ = *sq_tail_;
+
+        // Which operations this kernel knows (IORING_REGISTER_PROBE, 5.6)
+        alignas(struct io_uring_probe) uint8_t buf[sizeof(struct io_uring_probe) +
+                                                   256 * sizeof(struct io_uring_probe_op)] = {};
+        auto* probe = reinterpret_cast<struct io_uring_probe*>(buf);
+        if (reg(IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+        for (unsigned i = 0; i < probe->ops_len && i < 256; i++) {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) supported_[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        return true;
+    }
+
+    bool supports(unsigned op) const { return op < 256 && (supported_[op / 64] >> (op % 64)) & 1; }
+
+    // Pins `n` buffers for the *_FIXED operations. Fails under a
+    // tight RLIMIT_MEMLOCK on older kernels; plain READ/WRITE on the
+    // same memory still work then.
+    bool register_buffers(const struct iovec* iov, unsigned n) {
+        return reg(IORING_REGISTER_BUFFERS, iov, n) == 0;
+    }
+
+    // A zeroed entry to fill in, queued for the next submit(); null
+    // when the queue is full
+    struct io_uring_sqe* sqe() {
+        uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (tail_ - head >= sq_entries_) return nullptr;
+        uint32_t i = tail_ & sq_mask_;
+        struct io_uring_sqe* e = &sqes_[i];
+        std::memset(e, 0, sizeof *e);
+        sq_array_[i] = i;
+        tail_++;
+        queued_++;
+        return e;
+    }
+
+    // Submits the queued entries and waits until at least `wait`
+    // completions are ready; -errno on failure. When the kernel
+    // can't take every entry yet (completion queue full, or out of
+    // memory) it returns early with a completion ready, and the rest
+    // go with the next call once the caller has reaped it.
+    int submit(unsigned wait) {
+        __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+        for (;;) {
+            long k = ::syscall(__NR_io_uring_enter, fd_, queued_, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                               nullptr, 0);
+            if (k >= 0) {
+                queued_ -= static_cast<unsigned>(k);
+                in_flight_ += static_cast<unsigned>(k);
+                if (queued_ == 0 || ready()) return 0;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EBUSY) {
+                return -errno;
+            } else if (ready()) {
+                return 0;
+            }
+            // Nothing to reap yet: block for a completion rather than spin
+            if (in_flight_ == 0) return -EAGAIN;
+            int rc = this->wait();
+            if (rc < 0) return rc;
+        }
+    }
+
+    // Blocks until a completion is ready; -errno on failure
+    int wait() {
+        for (;;) {
+            if (::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0) return 0;
+            if (errno != EINTR) return -errno;
+        }
+    }
+
+    // Takes back the entries queued since the kernel last took any;
+    // returns their user_data
+    std::vector<uint64_t> unqueue() {
+        std::vector<uint64_t> out;
+        for (; queued_ > 0; queued_--) out.push_back(sqes_[--tail_ & sq_mask_].user_data);
+        __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+        return out;
+    }
+
+    // Entries the kernel took whose completions haven't been popped
+    unsigned in_flight() const { return in_flight_; }
+
+    // Pops one completion; false when none is ready
+    bool cqe(uint64_t& user_data, int32_t& res) {
+        uint32_t head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+        const struct io_uring_cqe& c = cqes_[head & cq_mask_];
+        user_data = c.user_data;
+        res = c.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        in_flight_--;
+        return true;
+    }
+
+private:
+    bool ready() const { return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); }
+
+    int reg(unsigned op, const void* arg, unsigned n) {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd_, op, arg, n));
+    }
+
+    int fd_ = -1;
+    void* sq_map_ = nullptr;
+    void* cq_map_ = nullptr;
+    size_t sq_map_size_ = 0;
+    size_t cq_map_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    uint32_t* sq_head_ = nullptr;
+    uint32_t* sq_tail_ = nullptr;
+    uint32_t* sq_array_ = nullptr;
+    uint32_t sq_mask_ = 0;
+    uint32_t sq_entries_ = 0;
+    uint32_t* cq_head_ = nullptr;
+    uint32_t* cq_tail_ = nullptr;
+    uint32_t cq_mask_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+    uint32_t tail_ = 0;     // local SQ tail, published by submit()
+    unsigned queued_ = 0;   // entries not yet taken by the kernel
+    unsigned in_flight_ = 0;  // taken, completion not yet popped
+    uint64_t supported_[4] = {};
+};
+
+#endif  // CLEANMETA_HAVE_URING
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+// -------------------------------------------------------------
+// Post-clean verification
+//
+// A byte scan of the output for residual metadata signatures,
+// using the C library's SIMD memchr/memmem. `sampled` looks at the
+// head and tail of the file only, `full` at every byte. Callers
+// run the expensive second parse only when the scan hits.
+// -------------------------------------------------------------
+enum class VerifyMode { off, sampled, full };
+
+static const char* verify_mode_name(VerifyMode mode) {
+    switch (mode) {
+        case VerifyMode::off:     return "off";
+        case VerifyMode::sampled: return "sampled";
+        case VerifyMode::full:    return "full";
+    }
+    return "unknown";
+}
+
+struct Signature {
+    const char* bytes;
+    size_t len;
+    const char* name;
+};
+
+static const Signature kImageSignatures[] = {
+    {"Exif\0\0", 6, "Exif"},
+    {"http://ns.adobe.com/xap", 23, "XMP"},
+    {"Photoshop 3.0", 13, "IPTC"},
+    {"8BIM", 4, "8BIM"},
+    {"tEXt", 4, "PNG tEXt"},
+    {"zTXt", 4, "PNG zTXt"},
+    {"iTXt", 4, "PNG iTXt"},
+    {"eXIf", 4, "PNG eXIf"},
+};
+
+static const Signature kPdfSignatures[] = {
+    {"/Author", 7, "/Author"},
+    {"/Creator", 8, "/Creator"},
+    {"/Producer", 9, "/Producer"},
+    {"/Keywords", 9, "/Keywords"},
+    {"<x:xmpmeta", 10, "XMP"},
+};
+
+struct VerifyHit {
+    const char* name = nullptr;
+    uint64_t offset = 0;
+};
+
+static const size_t kVerifySample = 64 * 1024;
+static const size_t kVerifyChunk = 1024 * 1024;
+
+static bool scan_buffer(const uint8_t* data, size_t n, uint64_t base,
+                        const Signature* sigs, size_t nsigs, VerifyHit& hit) {
+    for (size_t i = 0; i < nsigs; i++) {
+        const void* at = ::memmem(data, n, sigs[i].bytes, sigs[i].len);
+        if (at) {
+            hit.name = sigs[i].name;
+            hit.offset = base + static_cast<uint64_t>(static_cast<const uint8_t*>(at) - data);
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t pread_full(int fd, uint8_t* dst, size_t n, uint64_t off) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t k = ::pread(fd, dst + got, n - got, static_cast<off_t>(off + got));
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) throw std::system_error(errno, std::generic_category(), "pread");
+        if (k == 0) break;
+        got += static_cast<size_t>(k);
+    }
+    return got;
+}
+
+// Returns true (and fills `hit`) when any signature occurs in the
+// scanned part of the file
+template <size_t N>
+static bool scan_for_signatures(const fs::path& p, const Signature (&sigs)[N], VerifyMode mode,
+                                VerifyHit& hit) {
+    if (mode == VerifyMode::off) return false;
+    TraceSpan span("verify.scan");
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + p.string());
+    struct stat st {};
+    ::fstat(fd, &st);
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    size_t overlap = 0;
+    for (auto& s : sigs) overlap = std::max(overlap, s.len - 1);
+
+    bool found = false;
+    try {
+        std::vector<uint8_t> buf;
+        if (mode == VerifyMode::sampled && size > 2 * kVerifySample) {
+            buf.resize(kVerifySample);
+            size_t n = pread_full(fd, buf.data(), kVerifySample, 0);
+            found = scan_buffer(buf.data(), n, 0, sigs, N, hit);
+            if (!found) {
+                n = pread_full(fd, buf.data(), kVerifySample, size - kVerifySample);
+                found = scan_buffer(buf.data(), n, size - kVerifySample, sigs, N, hit);
+            }
+        } else {
+            buf.resize(kVerifyChunk + overlap);
+            uint64_t off = 0;
+            while (!found && off < size) {
+                size_t n = pread_full(fd, buf.data(), buf.size(), off);
+                if (n == 0) break;
+                found = scan_buffer(buf.data(), n, off, sigs, N, hit);
+                if (n < buf.size()) break;
+                off += n - overlap;
+            }
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    return found;
+}
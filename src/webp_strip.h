@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "exif_filter.h"
+#include "file_io.h"
+
+// -------------------------------------------------------------
+// Native WebP handler
+//
+// Walks the RIFF chunk list once, dropping the EXIF and "XMP "
+// chunks and clearing their flags in VP8X. VP8, VP8L, ALPH, ANIM,
+// ANMF, ICCP and unknown chunks are copied through undecoded, so
+// memory use is the I/O buffer however long the animation. The
+// RIFF size is patched at the end; bytes past it are dropped. When
+// the policy keeps Exif tags, EXIF is rebuilt with just those, and
+// its VP8X flag is set again once one has been written.
+// -------------------------------------------------------------
+static const uint8_t kWebpExifFlag = 0x08;
+static const uint8_t kWebpXmpFlag = 0x04;
+
+static uint32_t webp_le32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static void webp_put_le32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v);
+    p[1] = uint8_t(v >> 8);
+    p[2] = uint8_t(v >> 16);
+    p[3] = uint8_t(v >> 24);
+}
+
+static bool webp_drops_chunk(const uint8_t fourcc[4]) {
+    return std::memcmp(fourcc, "EXIF", 4) == 0 || std::memcmp(fourcc, "XMP ", 4) == 0;
+}
+
+// EXIF chunks larger than this are dropped whole rather than read into memory
+static const uint64_t kWebpMaxExif = 1u << 20;
+
+// Returns false when the input is not a well-formed RIFF/WEBP chunk
+// list; the caller then falls back to Exiv2.
+static bool strip_webp(InFile& in, OutFile& out, const KeepPolicy& keep, StripStats& st) {
+    uint8_t hdr[12];
+    if (!in.read(hdr, sizeof hdr)) return false;
+    if (std::memcmp(hdr, "RIFF", 4) != 0 || std::memcmp(hdr + 8, "WEBP", 4) != 0) return false;
+    uint64_t riff_end = 8 + uint64_t(webp_le32(hdr + 4));
+    out.write(hdr, sizeof hdr);
+    uint64_t flags_at = 0;  // output offset of the VP8X flags byte
+    uint8_t flags = 0;
+    bool kept_exif = false;
+
+    while (in.offset() < riff_end) {
+        uint8_t ch[8];
+        if (!in.read(ch, sizeof ch)) return false;
+        uint64_t len = webp_le32(ch + 4);
+        uint64_t body = len + (len & 1);  // payloads are padded to even
+        if (in.offset() + body > riff_end) return false;
+
+        if (keep.keeps_exif && std::memcmp(ch, "EXIF", 4) == 0 && body <= kWebpMaxExif) {
+            std::vector<uint8_t> data(body), kept;
+            if (!in.read(data.data(), data.size())) return false;
+            // Some writers put the JPEG "Exif\0\0" prefix in front of the TIFF header
+            size_t skip = len >= 6 && std::memcmp(data.data(), "Exif\0\0", 6) == 0 ? 6 : 0;
+            filter_exif(data.data() + skip, len - skip, keep, kept);
+            if (!kept.empty() && kept.size() + skip <= 0xFFFFFFFEu) {
+                kept.insert(kept.begin(), data.begin(), data.begin() + skip);
+                uint8_t h[8];
+                std::memcpy(h, "EXIF", 4);
+                webp_put_le32(h + 4, static_cast<uint32_t>(kept.size()));
+                out.write(h, sizeof h);
+                out.write(kept.data(), kept.size());
+                if (kept.size() & 1) out.write_u8(0);
+                st.bytes_removed += body - kept.size() - (kept.size() & 1);
+                kept_exif = true;
+                continue;
+            }
+            st.segments_removed++;
+            st.bytes_removed += 8 + body;
+            continue;
+        }
+
+        if (webp_drops_chunk(ch)) {
+            if (!in.skip(body)) return false;
+            st.segments_removed++;
+            st.bytes_removed += 8 + body;
+            continue;
+        }
+
+        out.write(ch, sizeof ch);
+        if (std::memcmp(ch, "VP8X", 4) == 0 && len >= 1) {
+            if (!in.read_u8(flags)) return false;
+            flags &= uint8_t(~(kWebpExifFlag | kWebpXmpFlag));
+            flags_at = out.written();
+            out.write_u8(flags);
+            body--;
+        }
+        if (in.copy_to(out, body) != body) return false;
+    }
+
+    // Trailing bytes after the RIFF payload are not part of the image
+    st.bytes_removed += in.skip_all();
+    if (out.written() - 8 > 0xFFFFFFFFu) return false;
+    uint8_t size[4];
+    webp_put_le32(size, uint32_t(out.written() - 8));
+    out.write_at(4, size, sizeof size);
+    if (kept_exif && flags_at) {
+        flags |= kWebpExifFlag;
+        out.write_at(flags_at, &flags, 1);
+    }
+    return true;
+}